@@ -2,14 +2,46 @@
 #include<conio.h>
 #include<dos.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 
 #include <math.h>
 #include <iostream>
+#include <chrono>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// the MinGW builds using the win32 thread model have no std::thread, the parallel loops then run serially
+#if defined(_GLIBCXX_HAS_GTHREADS) || !defined(__GLIBCXX__)
+#define HAS_STD_THREAD 1
+#include <atomic>
+#include <thread>
+#else
+#define HAS_STD_THREAD 0
+#include <windows.h>
+#endif
+
+#if defined(__linux__)
+#include <atomic>
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 #define TO_MILLI_SECONDS(x) ((x) * 1000)
 #define TO_KILO_METERS(y) ((y) * 1000)
 
 static const float DEG2RAD = 3.14159f / 180.0f;
+static const float PI = 3.14159265f;
 static const float GRAVITATIONAL_CONSTANT = 10.0f; 	// 6.67430f * 10 ^ -11 kg
 static const float SUN_MASS = 100000.0f;			// 1.988 * 10 ^ 30 kg
 
@@ -18,11 +50,171 @@ static const float PLANET_MASS_MIN = 30.0f; 			// 3.301 * 10 ^ 23 kg 	mass of th
 static const int PLANET_RADIUS_MAX = 20;
 static const int PLANET_RADIUS_MIN = 5;
 static const int SUN_RADIUS = 30;
+static const uint32_t SPAWN_SEED = 12345;
 
 static inline float min(float v1, float v2) { return (v1 > v2) ? v2 : v1; }
 static inline int min(int v1, int v2) { return (v1 > v2) ? v2 : v1; }
+static inline float max(float v1, float v2) { return (v1 > v2) ? v1 : v2; }
 static inline int sign(float value) { return (value >= 0) ? 1: -1; }
 
+// returns the number of worker threads to be used by the parallel loops
+static int getWorkerCount()
+{
+#if HAS_STD_THREAD
+	int count = (int)std::thread::hardware_concurrency();
+	return (count > 0) ? count : 1;
+#else
+	return 1;
+#endif
+}
+
+// splits [0, count) into contiguous chunks and calls func(begin, end) for each chunk on its own thread
+// threadCount <= 0 means use all the available hardware threads
+template<typename Func>
+static void parallelFor(int count, int threadCount, Func func)
+{
+	if(threadCount <= 0)
+		threadCount = getWorkerCount();
+	threadCount = min(threadCount, count);
+	
+	// not worth spawning any thread
+	if(threadCount <= 1)
+	{
+		if(count > 0)
+			func(0, count);
+		return;
+	}
+	
+#if HAS_STD_THREAD
+	int chunkSize = (count + threadCount - 1) / threadCount;
+	std::thread* threads = new std::thread[threadCount - 1];
+	for(int i = 1; i < threadCount; i++)
+	{
+		int begin = i * chunkSize;
+		int end = min(begin + chunkSize, count);
+		if(begin < end)
+			threads[i - 1] = std::thread(func, begin, end);
+	}
+	
+	// the calling thread takes the first chunk
+	func(0, min(chunkSize, count));
+	
+	for(int i = 0; i < (threadCount - 1); i++)
+		if(threads[i].joinable())
+			threads[i].join();
+	delete[] threads;
+#else
+	// no threads, run the same chunks one after the other
+	int chunkSize = (count + threadCount - 1) / threadCount;
+	for(int begin = 0; begin < count; begin += chunkSize)
+		func(begin, min(begin + chunkSize, count));
+#endif
+}
+
+// barrier for the threadCount chunks of one parallelFor call, which all run at the same time
+// the waiting threads spin (yielding), the phases it separates are expected to be short
+struct SpinBarrier
+{
+	private:
+		int threadCount;
+#if HAS_STD_THREAD
+		std::atomic<int> arrivedCount;
+		std::atomic<int> generation;
+#endif
+	
+	public:
+#if HAS_STD_THREAD
+		SpinBarrier(int _threadCount) : threadCount(_threadCount), arrivedCount(0), generation(0) { }
+#else
+		SpinBarrier(int _threadCount) : threadCount(_threadCount) { }
+#endif
+		SpinBarrier(const SpinBarrier&) = delete;
+		SpinBarrier& operator =(const SpinBarrier&) = delete;
+		
+		// returns once all the threads have called wait()
+		void wait()
+		{
+#if HAS_STD_THREAD
+			if(threadCount <= 1) return;
+			int currentGeneration = generation.load(std::memory_order_acquire);
+			if(arrivedCount.fetch_add(1, std::memory_order_acq_rel) == (threadCount - 1))
+			{
+				// the last thread to arrive releases the others
+				arrivedCount.store(0, std::memory_order_relaxed);
+				generation.fetch_add(1, std::memory_order_release);
+				return;
+			}
+			while(generation.load(std::memory_order_acquire) == currentGeneration)
+				std::this_thread::yield();
+#endif
+		}
+};
+
+// stable parallel LSD radix sort of (keys, values) by the 32 bit keys, 8 bits per pass
+// tempKeys and tempValues must hold count elements, the result ends up in keys and values
+template<typename T>
+static void radixSort(uint32_t* keys, T* values, uint32_t* tempKeys, T* tempValues, int count, int threadCount)
+{
+	if(threadCount <= 0)
+		threadCount = getWorkerCount();
+	int taskCount = min(threadCount, count);
+	if(taskCount <= 0) return;
+	
+	// histograms[task * 256 + digit], turned into scatter offsets
+	int* histograms = new int[taskCount * 256];
+	for(int shift = 0; shift < 32; shift += 8)
+	{
+		parallelFor(taskCount, taskCount, [=](int begin, int end)
+		{
+			for(int task = begin; task < end; task++)
+			{
+				int* histogram = histograms + task * 256;
+				for(int digit = 0; digit < 256; digit++)
+					histogram[digit] = 0;
+				int first = (int)((long long)count * task / taskCount);
+				int last = (int)((long long)count * (task + 1) / taskCount);
+				for(int i = first; i < last; i++)
+					++histogram[(keys[i] >> shift) & 0xFF];
+			}
+		});
+		
+		// digits in order, and for the same digit tasks in order (keeps the sort stable)
+		int offset = 0;
+		for(int digit = 0; digit < 256; digit++)
+			for(int task = 0; task < taskCount; task++)
+			{
+				int digitCount = histograms[task * 256 + digit];
+				histograms[task * 256 + digit] = offset;
+				offset += digitCount;
+			}
+		
+		parallelFor(taskCount, taskCount, [=](int begin, int end)
+		{
+			for(int task = begin; task < end; task++)
+			{
+				int* offsets = histograms + task * 256;
+				int first = (int)((long long)count * task / taskCount);
+				int last = (int)((long long)count * (task + 1) / taskCount);
+				for(int i = first; i < last; i++)
+				{
+					int destination = offsets[(keys[i] >> shift) & 0xFF]++;
+					tempKeys[destination] = keys[i];
+					tempValues[destination] = values[i];
+				}
+			}
+		});
+		
+		// 4 passes, so after the last swap the result is back in keys and values
+		uint32_t* swapKeys = keys;
+		keys = tempKeys;
+		tempKeys = swapKeys;
+		T* swapValues = values;
+		values = tempValues;
+		tempValues = swapValues;
+	}
+	delete[] histograms;
+}
+
 struct Vec2Int
 {
 	int x, y;
@@ -99,26 +291,188 @@ struct Vec2
 	float magnitude() const { return sqrt(x * x + y * y); }
 };
 
+// counter based random number generator (Philox4x32-10)
+// the output is a pure function of (seed, stream, subStream, draw number), so every body can draw
+// from its own stream independently of the others and of the thread which processes it
+struct RandomStream
+{
+	private:
+		uint32_t key[2];
+		uint32_t counter[4];
+		
+		// last generated block of 4 random words
+		uint32_t block[4];
+		// index of the next unused word in the block
+		int blockIndex;
+		
+		static uint32_t mulhilo(uint32_t a, uint32_t b, uint32_t* hi)
+		{
+			uint64_t product = (uint64_t)a * b;
+			*hi = (uint32_t)(product >> 32);
+			return (uint32_t)product;
+		}
+		
+		void generateBlock()
+		{
+			uint32_t c[4] = { counter[0], counter[1], counter[2], counter[3] };
+			uint32_t k[2] = { key[0], key[1] };
+			
+			// 10 rounds of philox
+			for(int round = 0; round < 10; round++)
+			{
+				uint32_t hi0, hi1;
+				uint32_t lo0 = mulhilo(0xD2511F53u, c[0], &hi0);
+				uint32_t lo1 = mulhilo(0xCD9E8D57u, c[2], &hi1);
+				c[0] = hi1 ^ c[1] ^ k[0];
+				c[1] = lo1;
+				c[2] = hi0 ^ c[3] ^ k[1];
+				c[3] = lo0;
+				
+				// bump the key
+				k[0] += 0x9E3779B9u;
+				k[1] += 0xBB67AE85u;
+			}
+			
+			for(int i = 0; i < 4; i++)
+				block[i] = c[i];
+			blockIndex = 0;
+			
+			// next block
+			++counter[0];
+		}
+		
+	public:
+		RandomStream(uint32_t seed, uint32_t stream, uint32_t subStream = 0) : blockIndex(4)
+		{
+			key[0] = seed;
+			key[1] = 0x2545F491u;
+			counter[0] = 0;
+			counter[1] = stream;
+			counter[2] = subStream;
+			counter[3] = 0;
+		}
+		
+		uint32_t nextUInt()
+		{
+			if(blockIndex >= 4)
+				generateBlock();
+			return block[blockIndex++];
+		}
+		
+		// uniformly distributed in (0, 1), never returns exactly 0 or 1
+		float nextFloat()
+		{
+			// 23 bits, so that k + 0.5 is exact in a float and the result stays below 1
+			return ((nextUInt() >> 9) + 0.5f) * (1.0f / 8388608.0f);
+		}
+		
+		// uniformly distributed in (min, max)
+		float nextFloat(float min, float max)
+		{
+			return min + (max - min) * nextFloat();
+		}
+};
+
+struct GravitySimulator;
+
+// state of the simulated bodies as contiguous arrays (structure of arrays), owned by the GravitySimulator
+// slot i belongs to the i-th rigidbody of the simulator, see Transform::attach
+struct BodyStorage
+{
+	GravitySimulator* owner;
+	Vec2* positions;
+	Vec2* previousPositions;
+	Vec2* velocities;
+	float* masses;
+	
+	BodyStorage() : owner(NULL), positions(NULL), previousPositions(NULL), velocities(NULL), masses(NULL) { }
+};
+
 // transform
 struct Transform
 {
 	private:
 		Vec2 position;		// rectangular coordinates, origin is at the center of the screen
+		Vec2 previousPosition;	// position before the last physics step, used for render interpolation
 		float rotation; 	// euler angle rotation, +ve is anticlockwise and -ve is clockwise
+		
+		// while attached, the positions live in the slot bodyIndex of the storage instead of the members above
+		BodyStorage* storage;
+		int bodyIndex;
 	
 	public:
 		Transform()
 		{
 			position = Vec2(0, 0);
+			previousPosition = Vec2(0, 0);
 			rotation = 0;
+			storage = NULL;
+			bodyIndex = -1;
+		}
+		
+		// moves the positions into the slot bodyIndex of the storage
+		void attach(BodyStorage* storage, int bodyIndex)
+		{
+			storage->positions[bodyIndex] = position;
+			storage->previousPositions[bodyIndex] = previousPosition;
+			this->storage = storage;
+			this->bodyIndex = bodyIndex;
+		}
+		
+		// moves the positions back from the storage
+		void detach()
+		{
+			if(storage == NULL) return;
+			position = storage->positions[bodyIndex];
+			previousPosition = storage->previousPositions[bodyIndex];
+			storage = NULL;
+			bodyIndex = -1;
 		}
+		
+		// moves the transform as a result of a physics step, the current position becomes the previous one
+		void movePosition(const Vec2 position)
+		{
+			if(storage != NULL)
+			{
+				storage->previousPositions[bodyIndex] = storage->positions[bodyIndex];
+				storage->positions[bodyIndex] = position;
+				return;
+			}
+			previousPosition = this->position;
+			this->position = position;
+		}
+		
 		// setters
-		void setPosition(const Vec2 position)  { this->position = position; }
+		// teleports the transform, nothing to interpolate from
+		void setPosition(const Vec2 position)
+		{
+			if(storage != NULL)
+			{
+				storage->positions[bodyIndex] = position;
+				storage->previousPositions[bodyIndex] = position;
+				return;
+			}
+			this->position = position;
+			previousPosition = position;
+		}
 		void setRotation(const float rotation) { this->rotation = rotation; }
+		// the storage owner moved the slot of this transform (the state has already been moved)
+		void setBodyIndex(int bodyIndex) { this->bodyIndex = bodyIndex; }
 		
 		// getters
-		Vec2 getPosition() const { return position; }
+		Vec2 getPosition() const { return (storage != NULL) ? storage->positions[bodyIndex] : position; }
+		Vec2 getPreviousPosition() const { return (storage != NULL) ? storage->previousPositions[bodyIndex] : previousPosition; }
 		float getRotation() const { return rotation; }
+		BodyStorage* getStorage() const { return storage; }
+		int getBodyIndex() const { return bodyIndex; }
+		
+		// position between the last two physics states, alpha = 0 is the previous state and alpha = 1 is the current one
+		Vec2 getInterpolatedPosition(float alpha) const
+		{
+			Vec2 position = getPosition();
+			Vec2 previousPosition = getPreviousPosition();
+			return { previousPosition.x + (position.x - previousPosition.x) * alpha, previousPosition.y + (position.y - previousPosition.y) * alpha };
+		}
 };
 
 
@@ -134,37 +488,63 @@ struct Rigidbody
 		float mass;
 		
 		// current velocity of this rigidoby
+		// (while the transform is attached to a BodyStorage, the mass and the velocity live there as well)
 		Vec2 velocity;
 		
-		// current acceleration of this rigidbody
-		Vec2 acceleration;
-		
 	public:
 		Rigidbody(Transform* _transform, float _mass): transform(_transform), mass(_mass) { }
 		Rigidbody(const Rigidbody&) = delete;
 		Rigidbody& operator =(const Rigidbody&) = delete;
+		// leaves its GravitySimulator if it is still simulated (defined after GravitySimulator)
+		~Rigidbody();
 		
-		void update(float deltaTime)
+		// moves the state of the rigidbody (and of its transform) into the slot bodyIndex of the storage
+		void attach(BodyStorage* storage, int bodyIndex)
 		{
-			velocity += acceleration * deltaTime;
-			transform->setPosition(velocity * deltaTime + transform->getPosition());
-			acceleration = Vec2(0, 0);
+			storage->velocities[bodyIndex] = velocity;
+			storage->masses[bodyIndex] = mass;
+			transform->attach(storage, bodyIndex);
 		}
 		
-		// Force relative to the body
-		void applyForce(Vec2 force)
+		// moves the state back from the storage
+		void detach()
 		{
-			// f = m * a (newton's law)
-			acceleration = force * (1 / mass);	
+			BodyStorage* storage = transform->getStorage();
+			if(storage == NULL) return;
+			velocity = storage->velocities[transform->getBodyIndex()];
+			mass = storage->masses[transform->getBodyIndex()];
+			transform->detach();
 		}
 		
 		// setters
-		void setMass(float mass) { this->mass = mass; }
+		void setMass(float mass)
+		{
+			BodyStorage* storage = transform->getStorage();
+			if(storage != NULL)
+				storage->masses[transform->getBodyIndex()] = mass;
+			else
+				this->mass = mass;
+		}
+		void setVelocity(Vec2 velocity)
+		{
+			BodyStorage* storage = transform->getStorage();
+			if(storage != NULL)
+				storage->velocities[transform->getBodyIndex()] = velocity;
+			else
+				this->velocity = velocity;
+		}
 		
 		// getters
-		float getMass() const { return mass; }
-		Vec2 getVelocity() const { return velocity; }
-		Vec2 getAcceleration() const { return acceleration; }
+		float getMass() const
+		{
+			BodyStorage* storage = transform->getStorage();
+			return (storage != NULL) ? storage->masses[transform->getBodyIndex()] : mass;
+		}
+		Vec2 getVelocity() const
+		{
+			BodyStorage* storage = transform->getStorage();
+			return (storage != NULL) ? storage->velocities[transform->getBodyIndex()] : velocity;
+		}
 		Transform* getTransform() const { return transform; }
 };
 
@@ -179,22 +559,95 @@ struct CircleCollider
 		// Rigidbody for this collider
 		Rigidbody* rigidbody;
 		
+		// slot of the trail of this collider in a TrailHistory, -1 = none
+		int trailSlot;
+		
 	public:
-		CircleCollider(Rigidbody* _rigidbody, float _radius = 1) : radius(_radius), rigidbody(_rigidbody) { }
+		CircleCollider(Rigidbody* _rigidbody, float _radius = 1) : radius(_radius), rigidbody(_rigidbody), trailSlot(-1) { }
 		CircleCollider(const CircleCollider&) = delete;
 		CircleCollider& operator=(const CircleCollider&) = delete;
 		
+		// setters
+		void setTrailSlot(int trailSlot) { this->trailSlot = trailSlot; }
+		
 		// getters
 		Rigidbody* getRigidbody() { return rigidbody; }
 		float getRadius() const { return radius; }
+		int getTrailSlot() const { return trailSlot; }
+};
+
+
+// contact between two overlapping circle colliders
+struct Contact
+{
+	// indices of the colliders in the collider buffer
+	int a, b;
+	
+	// unit vector from a to b
+	Vec2 normal;
+	
+	// overlap of the two circles
+	float penetration;
+	
+	// accumulated normal impulse, warm started from the previous step
+	float impulse;
+	
+	// 1 / (inverseMassA + inverseMassB)
+	float effectiveMass;
+	
+	// target separating velocity (restitution and penetration recovery)
+	float bias;
+};
+
+// impulse of a contact in the previous step, keyed by its colliders
+struct CachedImpulse
+{
+	const CircleCollider* a;
+	const CircleCollider* b;
+	float impulse;
 };
 
+static int compareCachedImpulses(const void* p1, const void* p2)
+{
+	const CachedImpulse* c1 = (const CachedImpulse*)p1;
+	const CachedImpulse* c2 = (const CachedImpulse*)p2;
+	if(c1->a != c2->a)
+		return ((uintptr_t)c1->a < (uintptr_t)c2->a) ? -1 : 1;
+	if(c1->b != c2->b)
+		return ((uintptr_t)c1->b < (uintptr_t)c2->b) ? -1 : 1;
+	return 0;
+}
+
+// reallocates a scratch buffer (without preserving its contents) if it is smaller than required
+template<typename T>
+static void reserveBuffer(T*& buffer, int& capacity, int required)
+{
+	if(capacity >= required) return;
+	int newCapacity = (capacity == 0) ? 2 : capacity;
+	while(newCapacity < required)
+		newCapacity *= 2;
+	delete[] buffer;
+	buffer = new T[newCapacity];
+	capacity = newCapacity;
+}
+
 
 // collision resolver
+// finds the overlapping circles (sweep and prune along x) and solves the contacts with sequential impulses;
+// the contacts are greedily colored so that no two contacts of the same color share a collider, every color
+// (batch) is then solved in parallel, and the impulses are warm started from the previous step
+// all the iterations run in one parallel region, the threads wait for each other between two batches
+// the solver reads the batched contacts and the velocities as arrays (structure of arrays), 4 contacts at a time with SSE2
 struct CollisionResolver
 {
 	private:
 		typedef CircleCollider* PtrCircleCollider;
+		
+		// no two contacts of a color share a collider, contacts which don't fit in any color go to the last (serial) batch
+		enum { MAX_COLOR_COUNT = 64 };
+		
+		// contacts per solver thread, fewer contacts are not worth the synchronization between batches
+		enum { PARALLEL_BATCH_SIZE = 256 };
 	
 		// buffer
 		PtrCircleCollider* colliders;
@@ -204,6 +657,57 @@ struct CollisionResolver
 		// capacity of the colliders buffer
 		int capacity;
 		
+		// number of solver iterations per step
+		int iterationCount;
+		// coefficient of restitution of the contacts
+		float restitution;
+		// fraction of the penetration recovered per step, and the penetration allowed without correction
+		float penetrationRecovery;
+		float penetrationSlop;
+		// whether the impulses start from those of the previous step
+		bool warmStarting;
+		
+		// contacts of the current step, batchedContacts are the same contacts ordered by color
+		Contact* contacts;
+		Contact* batchedContacts;
+		int contactCount;
+		int contactCapacity;
+		int batchedContactCapacity;
+		
+		// first contact of every batch, batchStarts[MAX_COLOR_COUNT + 1] is the contact count
+		int batchStarts[MAX_COLOR_COUNT + 2];
+		
+		// impulses of the previous step, sorted by colliders
+		CachedImpulse* cachedImpulses;
+		int cachedImpulseCount;
+		int cachedImpulseCapacity;
+		
+		// batched contacts as arrays for the solver, contact i of the arrays is batchedContacts[i]
+		int* contactA;
+		int* contactB;
+		float* normalX;
+		float* normalY;
+		float* impulses;
+		float* effectiveMasses;
+		float* biases;
+		float* inverseMassA;
+		float* inverseMassB;
+		int contactArrayCapacity;
+		
+		// per collider scratch buffers
+		float* velocityX;
+		float* velocityY;
+		float* inverseMasses;
+		uint64_t* colorMasks;
+		uint32_t* sortKeys;
+		int* sortedColliders;
+		int velocityXCapacity;
+		int velocityYCapacity;
+		int inverseMassCapacity;
+		int colorMaskCapacity;
+		int sortKeyCapacity;
+		int sortedColliderCapacity;
+		
 		void resizeBuffer(int newCapacity)
 		{
 			// if the new capacity equals to the previous capacity then do nothing
@@ -229,10 +733,259 @@ struct CollisionResolver
 			
 			// replace the old buffer with the new one
 			colliders = newColliders;
+			capacity = newCapacity;
 		}
-	
+		
+		// reallocates the contact arrays (without preserving their contents) if they are smaller than required
+		void reserveContactArrays(int required)
+		{
+			if(contactArrayCapacity >= required) return;
+			int newCapacity = (contactArrayCapacity == 0) ? 16 : contactArrayCapacity;
+			while(newCapacity < required)
+				newCapacity *= 2;
+			delete[] contactA;
+			delete[] contactB;
+			delete[] normalX;
+			delete[] normalY;
+			delete[] impulses;
+			delete[] effectiveMasses;
+			delete[] biases;
+			delete[] inverseMassA;
+			delete[] inverseMassB;
+			contactA = new int[newCapacity];
+			contactB = new int[newCapacity];
+			normalX = new float[newCapacity];
+			normalY = new float[newCapacity];
+			impulses = new float[newCapacity];
+			effectiveMasses = new float[newCapacity];
+			biases = new float[newCapacity];
+			inverseMassA = new float[newCapacity];
+			inverseMassB = new float[newCapacity];
+			contactArrayCapacity = newCapacity;
+		}
+		
+		void addContact(int a, int b, Vec2 normal, float penetration)
+		{
+			if(contactCount == contactCapacity)
+			{
+				int newCapacity = (contactCapacity == 0) ? 16 : contactCapacity * 2;
+				Contact* newContacts = new Contact[newCapacity];
+				for(int i = 0; i < contactCount; i++)
+					newContacts[i] = contacts[i];
+				delete[] contacts;
+				contacts = newContacts;
+				contactCapacity = newCapacity;
+			}
+			Contact& contact = contacts[contactCount++];
+			contact.a = a;
+			contact.b = b;
+			contact.normal = normal;
+			contact.penetration = penetration;
+			contact.impulse = 0;
+		}
+		
+		// sweep and prune along x
+		void findContacts()
+		{
+			contactCount = 0;
+			reserveBuffer(sortKeys, sortKeyCapacity, colliderCount * 2);
+			reserveBuffer(sortedColliders, sortedColliderCapacity, colliderCount * 2);
+			
+			// order the colliders by the left edge of their bounding box, floats are mapped to order preserving integers
+			for(int i = 0; i < colliderCount; i++)
+			{
+				float minX = colliders[i]->getRigidbody()->getTransform()->getPosition().x - colliders[i]->getRadius();
+				uint32_t bits;
+				memcpy(&bits, &minX, sizeof(bits));
+				sortKeys[i] = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+				sortedColliders[i] = i;
+			}
+			radixSort(sortKeys, sortedColliders, sortKeys + colliderCount, sortedColliders + colliderCount, colliderCount, 1);
+			
+			for(int i = 0; i < colliderCount; i++)
+			{
+				int a = sortedColliders[i];
+				Vec2 positionA = colliders[a]->getRigidbody()->getTransform()->getPosition();
+				float radiusA = colliders[a]->getRadius();
+				float maxX = positionA.x + radiusA;
+				for(int j = i + 1; j < colliderCount; j++)
+				{
+					int b = sortedColliders[j];
+					Vec2 positionB = colliders[b]->getRigidbody()->getTransform()->getPosition();
+					float radiusB = colliders[b]->getRadius();
+					
+					// the rest of the colliders start to the right of a
+					if((positionB.x - radiusB) > maxX) break;
+					
+					Vec2 d(positionB.x - positionA.x, positionB.y - positionA.y);
+					float radiusSum = radiusA + radiusB;
+					float sqrDistance = d.sqrMagnitude();
+					if(sqrDistance >= (radiusSum * radiusSum)) continue;
+					
+					float distance = sqrt(sqrDistance);
+					Vec2 normal = (distance > 0) ? d * (1 / distance) : Vec2(1, 0);
+					if(a < b)
+						addContact(a, b, normal, radiusSum - distance);
+					else
+						addContact(b, a, normal * -1, radiusSum - distance);
+				}
+			}
+		}
+		
+		// impulse of the same pair of colliders in the previous step, 0 if they weren't touching
+		float findCachedImpulse(const CircleCollider* a, const CircleCollider* b) const
+		{
+			if(cachedImpulseCount == 0)
+				return 0;
+			CachedImpulse key = { a, b, 0 };
+			if((uintptr_t)a > (uintptr_t)b)
+			{
+				key.a = b;
+				key.b = a;
+			}
+			const CachedImpulse* cached = (const CachedImpulse*)bsearch(&key, cachedImpulses, cachedImpulseCount, sizeof(CachedImpulse), compareCachedImpulses);
+			return (cached != NULL) ? cached->impulse : 0;
+		}
+		
+		void cacheImpulses()
+		{
+			reserveBuffer(cachedImpulses, cachedImpulseCapacity, contactCount);
+			for(int i = 0; i < contactCount; i++)
+			{
+				const CircleCollider* a = colliders[batchedContacts[i].a];
+				const CircleCollider* b = colliders[batchedContacts[i].b];
+				CachedImpulse& cached = cachedImpulses[i];
+				cached.a = ((uintptr_t)a < (uintptr_t)b) ? a : b;
+				cached.b = ((uintptr_t)a < (uintptr_t)b) ? b : a;
+				cached.impulse = impulses[i];
+			}
+			cachedImpulseCount = contactCount;
+			qsort(cachedImpulses, cachedImpulseCount, sizeof(CachedImpulse), compareCachedImpulses);
+		}
+		
+		// greedy coloring of the contact graph (colliders are the vertices), the contacts are then grouped by color
+		void buildBatches()
+		{
+			reserveBuffer(colorMasks, colorMaskCapacity, colliderCount);
+			reserveBuffer(batchedContacts, batchedContactCapacity, contactCount);
+			reserveBuffer(sortedColliders, sortedColliderCapacity, contactCount);
+			for(int i = 0; i < colliderCount; i++)
+				colorMasks[i] = 0;
+			
+			// the color of every contact is kept in sortedColliders (reused as scratch)
+			int* colors = sortedColliders;
+			int colorCounts[MAX_COLOR_COUNT + 1] = { };
+			for(int i = 0; i < contactCount; i++)
+			{
+				uint64_t used = colorMasks[contacts[i].a] | colorMasks[contacts[i].b];
+				int color = 0;
+				while((color < MAX_COLOR_COUNT) && (used & ((uint64_t)1 << color)))
+					++color;
+				if(color < MAX_COLOR_COUNT)
+				{
+					colorMasks[contacts[i].a] |= (uint64_t)1 << color;
+					colorMasks[contacts[i].b] |= (uint64_t)1 << color;
+				}
+				colors[i] = color;
+				++colorCounts[color];
+			}
+			
+			batchStarts[0] = 0;
+			for(int color = 0; color <= MAX_COLOR_COUNT; color++)
+				batchStarts[color + 1] = batchStarts[color] + colorCounts[color];
+			int offsets[MAX_COLOR_COUNT + 1];
+			for(int color = 0; color <= MAX_COLOR_COUNT; color++)
+				offsets[color] = batchStarts[color];
+			for(int i = 0; i < contactCount; i++)
+				batchedContacts[offsets[colors[i]]++] = contacts[i];
+			
+			reserveContactArrays(contactCount);
+			for(int i = 0; i < contactCount; i++)
+			{
+				const Contact& contact = batchedContacts[i];
+				contactA[i] = contact.a;
+				contactB[i] = contact.b;
+				normalX[i] = contact.normal.x;
+				normalY[i] = contact.normal.y;
+				impulses[i] = contact.impulse;
+				effectiveMasses[i] = contact.effectiveMass;
+				biases[i] = contact.bias;
+				inverseMassA[i] = inverseMasses[contact.a];
+				inverseMassB[i] = inverseMasses[contact.b];
+			}
+		}
+		
+		// solves the contacts [begin, end) of the contact arrays, vectorize only when they share no collider,
+		// 4 lanes on the same collider would each scatter over the others' velocity
+		void solveContacts(int begin, int end, bool vectorize)
+		{
+			int i = begin;
+#if defined(__SSE2__)
+			// 4 contacts per iteration, the velocities are gathered and scattered one lane at a time
+			__m128 zero = _mm_setzero_ps();
+			for(; vectorize && ((i + 4) <= end); i += 4)
+			{
+				const int* a = contactA + i;
+				const int* b = contactB + i;
+				__m128 velocityAX = _mm_set_ps(velocityX[a[3]], velocityX[a[2]], velocityX[a[1]], velocityX[a[0]]);
+				__m128 velocityAY = _mm_set_ps(velocityY[a[3]], velocityY[a[2]], velocityY[a[1]], velocityY[a[0]]);
+				__m128 velocityBX = _mm_set_ps(velocityX[b[3]], velocityX[b[2]], velocityX[b[1]], velocityX[b[0]]);
+				__m128 velocityBY = _mm_set_ps(velocityY[b[3]], velocityY[b[2]], velocityY[b[1]], velocityY[b[0]]);
+				__m128 nx = _mm_loadu_ps(normalX + i);
+				__m128 ny = _mm_loadu_ps(normalY + i);
+				__m128 normalVelocity = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(velocityBX, velocityAX), nx), _mm_mul_ps(_mm_sub_ps(velocityBY, velocityAY), ny));
+				
+				// clamp the accumulated impulse, contacts can only push
+				__m128 impulse = _mm_mul_ps(_mm_loadu_ps(effectiveMasses + i), _mm_sub_ps(_mm_loadu_ps(biases + i), normalVelocity));
+				__m128 previous = _mm_loadu_ps(impulses + i);
+				__m128 accumulated = _mm_max_ps(_mm_add_ps(previous, impulse), zero);
+				impulse = _mm_sub_ps(accumulated, previous);
+				_mm_storeu_ps(impulses + i, accumulated);
+				
+				__m128 impulseA = _mm_mul_ps(impulse, _mm_loadu_ps(inverseMassA + i));
+				__m128 impulseB = _mm_mul_ps(impulse, _mm_loadu_ps(inverseMassB + i));
+				float ax[4], ay[4], bx[4], by[4];
+				_mm_storeu_ps(ax, _mm_sub_ps(velocityAX, _mm_mul_ps(nx, impulseA)));
+				_mm_storeu_ps(ay, _mm_sub_ps(velocityAY, _mm_mul_ps(ny, impulseA)));
+				_mm_storeu_ps(bx, _mm_add_ps(velocityBX, _mm_mul_ps(nx, impulseB)));
+				_mm_storeu_ps(by, _mm_add_ps(velocityBY, _mm_mul_ps(ny, impulseB)));
+				for(int lane = 0; lane < 4; lane++)
+				{
+					velocityX[a[lane]] = ax[lane];
+					velocityY[a[lane]] = ay[lane];
+					velocityX[b[lane]] = bx[lane];
+					velocityY[b[lane]] = by[lane];
+				}
+			}
+#endif
+			for(; i < end; i++)
+			{
+				int a = contactA[i];
+				int b = contactB[i];
+				float normalVelocity = (velocityX[b] - velocityX[a]) * normalX[i] + (velocityY[b] - velocityY[a]) * normalY[i];
+				
+				// clamp the accumulated impulse, contacts can only push
+				float impulse = effectiveMasses[i] * (biases[i] - normalVelocity);
+				float accumulated = max(impulses[i] + impulse, 0.0f);
+				impulse = accumulated - impulses[i];
+				impulses[i] = accumulated;
+				
+				float impulseA = impulse * inverseMassA[i];
+				float impulseB = impulse * inverseMassB[i];
+				velocityX[a] -= normalX[i] * impulseA;
+				velocityY[a] -= normalY[i] * impulseA;
+				velocityX[b] += normalX[i] * impulseB;
+				velocityY[b] += normalY[i] * impulseB;
+			}
+		}
+		
 	public:
-		CollisionResolver(int _capacity = 10) : colliders(NULL), colliderCount(0)
+		CollisionResolver(int _capacity = 10) : colliders(NULL), colliderCount(0), capacity(0), iterationCount(8), restitution(0.5f), penetrationRecovery(0.2f),
+			penetrationSlop(0.5f), warmStarting(true), contacts(NULL), batchedContacts(NULL), contactCount(0), contactCapacity(0), batchedContactCapacity(0),
+			cachedImpulses(NULL), cachedImpulseCount(0), cachedImpulseCapacity(0), contactA(NULL), contactB(NULL), normalX(NULL), normalY(NULL),
+			impulses(NULL), effectiveMasses(NULL), biases(NULL), inverseMassA(NULL), inverseMassB(NULL), contactArrayCapacity(0), velocityX(NULL), velocityY(NULL),
+			inverseMasses(NULL), colorMasks(NULL), sortKeys(NULL), sortedColliders(NULL), velocityXCapacity(0), velocityYCapacity(0), inverseMassCapacity(0),
+			colorMaskCapacity(0), sortKeyCapacity(0), sortedColliderCapacity(0)
 		{
 			resizeBuffer(_capacity);
 		}
@@ -244,6 +997,24 @@ struct CollisionResolver
 			if(colliders != NULL)
 				delete[] colliders;
 			colliders = NULL;
+			delete[] contacts;
+			delete[] batchedContacts;
+			delete[] cachedImpulses;
+			delete[] contactA;
+			delete[] contactB;
+			delete[] normalX;
+			delete[] normalY;
+			delete[] impulses;
+			delete[] effectiveMasses;
+			delete[] biases;
+			delete[] inverseMassA;
+			delete[] inverseMassB;
+			delete[] velocityX;
+			delete[] velocityY;
+			delete[] inverseMasses;
+			delete[] colorMasks;
+			delete[] sortKeys;
+			delete[] sortedColliders;
 		}
 		
 		void addCollider(CircleCollider* collider)
@@ -271,9 +1042,10 @@ struct CollisionResolver
 				if(colliders[i] == collider)
 				{
 					// shift the rest of the colliders to the left obscuring the collider to be removed
-					for(int j = min(i + 1, capacity - 1); j < capacity; j++)
-						colliders[i - 1] = colliders[i];
+					for(int j = i + 1; j < colliderCount; j++)
+						colliders[j - 1] = colliders[j];
 					colliderCount--;
+					colliders[colliderCount] = NULL;
 					return;
 				}
 			}
@@ -283,265 +1055,2112 @@ struct CollisionResolver
 		const PtrCircleCollider* getColliderBuffer() const { return colliders; }
 		int getColliderCount() const { return colliderCount; }
 		
-		void resolve()
-		{
-			
-		}
-};
-
-
-// Gravity Simulator
-struct GravitySimulator
-{
-	private:
-		typedef Rigidbody* PtrRigidbody;
-	
-		// buffer
-		PtrRigidbody* rigidbodies;
-		// distance buffer
-		float* distances;
-		// capacity of the distance buffer
-		int combinationCapacity;
-		// number of unique pairs of rigibodies
-		int combinationCount;
-		// number of rigidbodies
-		int rigidbodyCount;
-		
-		// capacity of the rigidbody buffer
-		int capacity;
-		
-		void resizeBuffer(int newCapacity)
+		void resolve(float deltaTime)
 		{
-			// if the new capacity equals to the previous capacity then do nothing
-			if(newCapacity == capacity) return;
-			
-			// resize the distance buffer
-			int newCombinationCapacity = (int)((newCapacity - 1) * newCapacity * 0.5f + 0.001f);
-			if(newCombinationCapacity > 0)
+			findContacts();
+			if(contactCount == 0)
 			{
-				float* newDistances = new float[newCombinationCapacity];
-				if(distances != NULL)
-					delete[] distances;
-				distances = newDistances;
+				cachedImpulseCount = 0;
+				return;
 			}
 			
-			// allocate another buffer
-			PtrRigidbody* newRigidbodies = new PtrRigidbody[newCapacity];
+			// gather the velocities and inverse masses of the colliders
+			reserveBuffer(velocityX, velocityXCapacity, colliderCount);
+			reserveBuffer(velocityY, velocityYCapacity, colliderCount);
+			reserveBuffer(inverseMasses, inverseMassCapacity, colliderCount);
+			for(int i = 0; i < colliderCount; i++)
+			{
+				Rigidbody* rigidbody = colliders[i]->getRigidbody();
+				Vec2 velocity = rigidbody->getVelocity();
+				velocityX[i] = velocity.x;
+				velocityY[i] = velocity.y;
+				inverseMasses[i] = (rigidbody->getMass() > 0) ? 1 / rigidbody->getMass() : 0;
+			}
 			
-			if(rigidbodies != NULL)
+			// prepare the contacts and apply last step's impulses
+			for(int i = 0; i < contactCount; i++)
 			{
-				// copy the already existing rigidbody references/ptrs
-				int copyCount = min(newCapacity, rigidbodyCount);
-				for(int i = 0; i < copyCount; i++)
-					newRigidbodies[i] = rigidbodies[i];
-				rigidbodyCount = copyCount;
-				// deallocate the previous buffer
-				delete[] rigidbodies;
+				Contact& contact = contacts[i];
+				float inverseMassSum = inverseMasses[contact.a] + inverseMasses[contact.b];
+				contact.effectiveMass = (inverseMassSum > 0) ? 1 / inverseMassSum : 0;
+				
+				float normalVelocity = (velocityX[contact.b] - velocityX[contact.a]) * contact.normal.x + (velocityY[contact.b] - velocityY[contact.a]) * contact.normal.y;
+				float bounce = (normalVelocity < 0) ? -restitution * normalVelocity : 0;
+				float recovery = penetrationRecovery / deltaTime * max(contact.penetration - penetrationSlop, 0.0f);
+				contact.bias = max(bounce, recovery);
+				
+				if(warmStarting)
+				{
+					contact.impulse = findCachedImpulse(colliders[contact.a], colliders[contact.b]);
+					float impulseA = contact.impulse * inverseMasses[contact.a];
+					float impulseB = contact.impulse * inverseMasses[contact.b];
+					velocityX[contact.a] -= contact.normal.x * impulseA;
+					velocityY[contact.a] -= contact.normal.y * impulseA;
+					velocityX[contact.b] += contact.normal.x * impulseB;
+					velocityY[contact.b] += contact.normal.y * impulseB;
+				}
 			}
 			
-			// set the rest of empty blocks to NULL
-			for(int i = rigidbodyCount; i < newCapacity; i++)
-				newRigidbodies[i] = NULL;
+			buildBatches();
 			
-			// replace the old buffer with the new one
-			rigidbodies = newRigidbodies;
-		}
+			// contacts of a batch share no collider, so every thread solves a slice of the batch, and the threads
+			// meet at the barrier before the next batch; the last (overflow) batch is solved by the first thread alone, without SSE
+			int threadCount = min(getWorkerCount(), contactCount / PARALLEL_BATCH_SIZE);
+			if(threadCount < 1)
+				threadCount = 1;
+			SpinBarrier barrier(threadCount);
+			SpinBarrier* sharedBarrier = &barrier;
+			parallelFor(threadCount, threadCount, [=](int begin, int end)
+			{
+				for(int thread = begin; thread < end; thread++)
+				{
+					for(int iteration = 0; iteration < iterationCount; iteration++)
+					{
+						for(int color = 0; color <= MAX_COLOR_COUNT; color++)
+						{
+							int first = batchStarts[color];
+							int batchSize = batchStarts[color + 1] - first;
+							if(batchSize == 0) continue;
+							int sliceBegin = first, sliceEnd = first + batchSize;
+							if(color < MAX_COLOR_COUNT)
+							{
+								sliceBegin = first + (int)((int64_t)batchSize * thread / threadCount);
+								sliceEnd = first + (int)((int64_t)batchSize * (thread + 1) / threadCount);
+							}
+							else if(thread != 0)
+								sliceEnd = sliceBegin;
+							solveContacts(sliceBegin, sliceEnd, color < MAX_COLOR_COUNT);
+							sharedBarrier->wait();
+						}
+					}
+				}
+			});
+			
+			// write the velocities back
+			for(int i = 0; i < colliderCount; i++)
+				colliders[i]->getRigidbody()->setVelocity(Vec2(velocityX[i], velocityY[i]));
+			
+			cacheImpulses();
+		}
+		
+		// setters
+		void setIterationCount(int iterationCount) { this->iterationCount = iterationCount; }
+		void setRestitution(float restitution) { this->restitution = restitution; }
+		void setWarmStarting(bool warmStarting) { this->warmStarting = warmStarting; }
+		
+		// getters
+		int getIterationCount() const { return iterationCount; }
+		float getRestitution() const { return restitution; }
+		bool getWarmStarting() const { return warmStarting; }
+		int getContactCount() const { return contactCount; }
+};
+
+
+// complex number for the FFT
+struct Complex
+{
+	float re, im;
+};
+
+// in-place iterative radix-2 FFT, n must be a power of 2
+// the inverse transform is not normalized
+static void fft(Complex* data, int n, bool inverse)
+{
+	// bit reversal permutation
+	for(int i = 1, j = 0; i < n; i++)
+	{
+		int bit = n >> 1;
+		for(; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if(i < j)
+		{
+			Complex temp = data[i];
+			data[i] = data[j];
+			data[j] = temp;
+		}
+	}
+	
+	// butterflies
+	for(int length = 2; length <= n; length <<= 1)
+	{
+		double angle = (inverse ? 2 : -2) * 3.14159265358979323846 / length;
+		double wlenRe = cos(angle), wlenIm = sin(angle);
+		for(int i = 0; i < n; i += length)
+		{
+			double wRe = 1, wIm = 0;
+			for(int j = 0; j < (length / 2); j++)
+			{
+				Complex& u = data[i + j];
+				Complex& v = data[i + j + length / 2];
+				float vRe = (float)(v.re * wRe - v.im * wIm);
+				float vIm = (float)(v.re * wIm + v.im * wRe);
+				v.re = u.re - vRe;
+				v.im = u.im - vIm;
+				u.re += vRe;
+				u.im += vIm;
+				
+				double temp = wRe * wlenRe - wIm * wlenIm;
+				wIm = wRe * wlenIm + wIm * wlenRe;
+				wRe = temp;
+			}
+		}
+	}
+}
+
+// in-place 2D FFT of a row major n x n grid, rows and then columns are transformed in parallel
+// the inverse transform is normalized by 1 / (n * n)
+static void fft2D(Complex* data, int n, bool inverse, int threadCount)
+{
+	parallelFor(n, threadCount, [=](int begin, int end)
+	{
+		for(int row = begin; row < end; row++)
+			fft(data + row * n, n, inverse);
+	});
+	
+	parallelFor(n, threadCount, [=](int begin, int end)
+	{
+		Complex* column = new Complex[n];
+		float scale = inverse ? 1.0f / ((float)n * n) : 1.0f;
+		for(int x = begin; x < end; x++)
+		{
+			for(int y = 0; y < n; y++)
+				column[y] = data[y * n + x];
+			fft(column, n, inverse);
+			for(int y = 0; y < n; y++)
+			{
+				data[y * n + x].re = column[y].re * scale;
+				data[y * n + x].im = column[y].im * scale;
+			}
+		}
+		delete[] column;
+	});
+}
+
+// spreads the lower 16 bits of v so that there is a 0 bit between every two bits
+static inline uint32_t spreadBits(uint32_t v)
+{
+	v &= 0x0000FFFFu;
+	v = (v | (v << 8)) & 0x00FF00FFu;
+	v = (v | (v << 4)) & 0x0F0F0F0Fu;
+	v = (v | (v << 2)) & 0x33333333u;
+	v = (v | (v << 1)) & 0x55555555u;
+	return v;
+}
+
+// position along the Z order curve of the cell (x, y) of a 65536 x 65536 grid
+static inline uint32_t mortonKey(uint32_t x, uint32_t y)
+{
+	return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+// position along the Hilbert curve of the cell (x, y) of a 65536 x 65536 grid
+static inline uint32_t hilbertKey(uint32_t x, uint32_t y)
+{
+	uint32_t key = 0;
+	for(uint32_t s = 1u << 15; s > 0; s >>= 1)
+	{
+		uint32_t rx = (x & s) ? 1 : 0;
+		uint32_t ry = (y & s) ? 1 : 0;
+		key += s * s * ((3 * rx) ^ ry);
+		
+		// rotate the quadrant
+		if(ry == 0)
+		{
+			if(rx == 1)
+			{
+				x = 65535 - x;
+				y = 65535 - y;
+			}
+			uint32_t temp = x;
+			x = y;
+			y = temp;
+		}
+	}
+	return key;
+}
+
+// particle-mesh gravity solver
+// deposits the masses onto a square mesh covering all the bodies, convolves the mesh with the softened
+// gravitational potential (-G / sqrt(r * r + h * h), h = cell size) using zero padded FFTs (isolated boundaries)
+// and interpolates the mesh forces back to the bodies with the same assignment scheme
+// the mesh either covers a fixed domain, with the bodies outside of it only feeling the monopole of the mesh, or is
+// fitted to the bodies every step (its size rounded up to a power of 2 so that the kernel spectrum can be reused)
+// the optional short range (P3M) correction replaces the softened force by the exact one for close pairs
+struct ParticleMeshSolver
+{
+	public:
+		enum MassAssignment
+		{
+			CLOUD_IN_CELL,			// 2 x 2 cells per body
+			TRIANGULAR_SHAPED_CLOUD	// 3 x 3 cells per body
+		};
+		
+	private:
+		// mass assignment (and force interpolation) scheme
+		MassAssignment massAssignment;
+		
+		// number of cells along one side of the mesh, power of 2
+		int meshSize;
+		
+		// whether the short range correction is enabled, and its radius in cells
+		bool shortRangeCorrection;
+		float shortRangeRadius;
+		
+		// number of threads to use, <= 0 means all the hardware threads
+		int threadCount;
+		
+		// one mass mesh per deposit task, reduced into the first one
+		float* masses;
+		int massMeshCount;
+		
+		// zero padded (2 * meshSize) ^ 2 work meshes for the convolution
+		Complex* densitySpectrum;
+		Complex* kernelSpectrum;
+		
+		// acceleration field on the mesh
+		Vec2* field;
+		
+		// cell linked lists for the short range correction
+		int* cellHeads;
+		int* nextInCell;
+		int nextInCellCapacity;
+		
+		// side of the fixed square domain of the mesh (centered on the origin), 0 = fit the mesh to the bodies every step
+		float domainSize;
+		
+		// mesh placement of the current step, bodies outside [domainMin, domainMax] are not on the mesh
+		Vec2 origin;
+		float cellSize;
+		Vec2 domainMin;
+		Vec2 domainMax;
+		
+		// total mass and center of mass of the bodies on the mesh, the bodies off the mesh are only attracted by it
+		float meshMass;
+		Vec2 meshCenter;
+		
+		// cell size the kernel spectrum was computed for, 0 if not computed yet
+		float kernelCellSize;
+		
+		// the FFTs need a power of 2, and 4 cells are the margins of the stencils
+		static int validMeshSize(int meshSize)
+		{
+			int size = 8;
+			while(size < meshSize)
+				size *= 2;
+			if(size != meshSize)
+				std::cout << "[Warning]: the mesh size " << meshSize << " is not a power of 2 of at least 8, " << size << " is used instead\n";
+			return size;
+		}
+		
+		void releaseMeshes()
+		{
+			delete[] masses;
+			delete[] densitySpectrum;
+			delete[] kernelSpectrum;
+			delete[] field;
+			delete[] cellHeads;
+			masses = NULL;
+			densitySpectrum = NULL;
+			kernelSpectrum = NULL;
+			field = NULL;
+			cellHeads = NULL;
+			kernelCellSize = 0;
+		}
+		
+		void allocateMeshes(int taskCount)
+		{
+			if((masses != NULL) && (massMeshCount == taskCount))
+				return;
+			releaseMeshes();
+			int paddedSize = 2 * meshSize;
+			massMeshCount = taskCount;
+			masses = new float[meshSize * meshSize * taskCount];
+			densitySpectrum = new Complex[paddedSize * paddedSize];
+			kernelSpectrum = new Complex[paddedSize * paddedSize];
+			field = new Vec2[meshSize * meshSize];
+			cellHeads = new int[meshSize * meshSize];
+		}
+		
+		// returns the first cell of the stencil and writes the weights of the stencil cells along one axis
+		// u is the position in cell units relative to the center of the first cell
+		int computeWeights(float u, float* weights) const
+		{
+			if(massAssignment == CLOUD_IN_CELL)
+			{
+				int cell = (int)floor(u);
+				float f = u - cell;
+				weights[0] = 1 - f;
+				weights[1] = f;
+				weights[2] = 0;
+				return cell;
+			}
+			int cell = (int)floor(u + 0.5f);
+			float d = u - cell;
+			weights[0] = 0.5f * (0.5f - d) * (0.5f - d);
+			weights[1] = 0.75f - d * d;
+			weights[2] = 0.5f * (0.5f + d) * (0.5f + d);
+			return cell - 1;
+		}
+		
+		bool isOnMesh(Vec2 position) const
+		{
+			return (position.x >= domainMin.x) && (position.x <= domainMax.x) && (position.y >= domainMin.y) && (position.y <= domainMax.y);
+		}
+		
+		// places the mesh over the fixed domain, or else over the bounding box of the bodies, with a margin of 2 cells for the stencils
+		void placeMesh(const Vec2* positions, int count)
+		{
+			if(domainSize > 0)
+			{
+				cellSize = domainSize / (meshSize - 4);
+				domainMin = Vec2(-0.5f * domainSize, -0.5f * domainSize);
+				domainMax = Vec2(0.5f * domainSize, 0.5f * domainSize);
+				origin = Vec2(domainMin.x - 2 * cellSize, domainMin.y - 2 * cellSize);
+				return;
+			}
+			
+			Vec2 minCorner = positions[0];
+			Vec2 maxCorner = minCorner;
+			for(int i = 1; i < count; i++)
+			{
+				Vec2 position = positions[i];
+				minCorner.x = min(minCorner.x, position.x);
+				minCorner.y = min(minCorner.y, position.y);
+				maxCorner.x = max(maxCorner.x, position.x);
+				maxCorner.y = max(maxCorner.y, position.y);
+			}
+			float extent = max(maxCorner.x - minCorner.x, maxCorner.y - minCorner.y);
+			if(extent <= 0)
+				extent = 1;
+			
+			// round up to a power of 2, so that the cell size (and the cached kernel spectrum) only changes
+			// when the bodies spread or gather by a factor of 2
+			extent = pow(2.0f, ceil(log2(extent)));
+			cellSize = extent / (meshSize - 4);
+			origin = Vec2(minCorner.x - 2 * cellSize, minCorner.y - 2 * cellSize);
+			domainMin = minCorner;
+			domainMax = maxCorner;
+		}
+		
+		void computeMeshMass(const Vec2* positions, const float* bodyMasses, int count)
+		{
+			double mass = 0, x = 0, y = 0;
+			for(int i = 0; i < count; i++)
+			{
+				if(!isOnMesh(positions[i])) continue;
+				mass += bodyMasses[i];
+				x += bodyMasses[i] * positions[i].x;
+				y += bodyMasses[i] * positions[i].y;
+			}
+			meshMass = (float)mass;
+			meshCenter = (mass > 0) ? Vec2((float)(x / mass), (float)(y / mass)) : Vec2(0, 0);
+		}
+		
+		void deposit(const Vec2* positions, const float* bodyMasses, int count)
+		{
+			int cellCount = meshSize * meshSize;
+			int taskCount = massMeshCount;
+			
+			// every task deposits a contiguous range of bodies into its own mesh
+			parallelFor(taskCount, taskCount, [=](int begin, int end)
+			{
+				for(int task = begin; task < end; task++)
+				{
+					float* mesh = masses + task * cellCount;
+					for(int i = 0; i < cellCount; i++)
+						mesh[i] = 0;
+					int first = (int)((long long)count * task / taskCount);
+					int last = (int)((long long)count * (task + 1) / taskCount);
+					for(int i = first; i < last; i++)
+					{
+						Vec2 position = positions[i];
+						float mass = bodyMasses[i];
+						if(!isOnMesh(position)) continue;
+						float wx[3], wy[3];
+						int x0 = computeWeights((position.x - origin.x) / cellSize - 0.5f, wx);
+						int y0 = computeWeights((position.y - origin.y) / cellSize - 0.5f, wy);
+						for(int y = 0; y < 3; y++)
+							for(int x = 0; x < 3; x++)
+								mesh[(y0 + y) * meshSize + x0 + x] += mass * wx[x] * wy[y];
+					}
+				}
+			});
+			
+			// reduce the task meshes into the first one
+			parallelFor(cellCount, threadCount, [=](int begin, int end)
+			{
+				for(int task = 1; task < taskCount; task++)
+				{
+					const float* mesh = masses + task * cellCount;
+					for(int i = begin; i < end; i++)
+						masses[i] += mesh[i];
+				}
+			});
+		}
+		
+		void computeKernelSpectrum()
+		{
+			// the kernel only depends on the cell size
+			if(kernelCellSize == cellSize)
+				return;
+			kernelCellSize = cellSize;
+			
+			int paddedSize = 2 * meshSize;
+			float softening = cellSize * cellSize;
+			Complex* kernel = kernelSpectrum;
+			parallelFor(paddedSize, threadCount, [=](int begin, int end)
+			{
+				for(int y = begin; y < end; y++)
+				{
+					// distances wrap around the padded mesh
+					int dy = (y <= meshSize) ? y : paddedSize - y;
+					for(int x = 0; x < paddedSize; x++)
+					{
+						int dx = (x <= meshSize) ? x : paddedSize - x;
+						float sqrDistance = (dx * dx + dy * dy) * cellSize * cellSize;
+						kernel[y * paddedSize + x].re = -GRAVITATIONAL_CONSTANT / sqrt(sqrDistance + softening);
+						kernel[y * paddedSize + x].im = 0;
+					}
+				}
+			});
+			fft2D(kernelSpectrum, paddedSize, false, threadCount);
+		}
+		
+		// potential = masses (*) kernel, then field = -gradient(potential)
+		void solvePotential()
+		{
+			int paddedSize = 2 * meshSize;
+			Complex* density = densitySpectrum;
+			const float* mesh = masses;
+			int size = meshSize;
+			parallelFor(paddedSize, threadCount, [=](int begin, int end)
+			{
+				for(int y = begin; y < end; y++)
+					for(int x = 0; x < paddedSize; x++)
+					{
+						Complex& c = density[y * paddedSize + x];
+						c.re = ((x < size) && (y < size)) ? mesh[y * size + x] : 0;
+						c.im = 0;
+					}
+			});
+			fft2D(densitySpectrum, paddedSize, false, threadCount);
+			
+			const Complex* kernel = kernelSpectrum;
+			parallelFor(paddedSize * paddedSize, threadCount, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					Complex a = density[i];
+					Complex b = kernel[i];
+					density[i].re = a.re * b.re - a.im * b.im;
+					density[i].im = a.re * b.im + a.im * b.re;
+				}
+			});
+			fft2D(densitySpectrum, paddedSize, true, threadCount);
+			
+			// central differences, the potential is the real part of the first meshSize x meshSize block
+			Vec2* field = this->field;
+			float scale = -0.5f / cellSize;
+			parallelFor(size, threadCount, [=](int begin, int end)
+			{
+				for(int y = begin; y < end; y++)
+					for(int x = 0; x < size; x++)
+					{
+						Vec2& a = field[y * size + x];
+						if((x == 0) || (y == 0) || (x == (size - 1)) || (y == (size - 1)))
+						{
+							a = Vec2(0, 0);
+							continue;
+						}
+						a.x = scale * (density[y * paddedSize + x + 1].re - density[y * paddedSize + x - 1].re);
+						a.y = scale * (density[(y + 1) * paddedSize + x].re - density[(y - 1) * paddedSize + x].re);
+					}
+			});
+		}
+		
+		void interpolate(const Vec2* positions, int count, Vec2* accelerations)
+		{
+			parallelFor(count, threadCount, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					Vec2 position = positions[i];
+					if(!isOnMesh(position))
+					{
+						// monopole of the mesh
+						Vec2 d(meshCenter.x - position.x, meshCenter.y - position.y);
+						float sqrDistance = d.sqrMagnitude();
+						accelerations[i] = (sqrDistance > 0) ? d * (GRAVITATIONAL_CONSTANT * meshMass / (sqrDistance * sqrt(sqrDistance))) : Vec2(0, 0);
+						continue;
+					}
+					float wx[3], wy[3];
+					int x0 = computeWeights((position.x - origin.x) / cellSize - 0.5f, wx);
+					int y0 = computeWeights((position.y - origin.y) / cellSize - 0.5f, wy);
+					Vec2 acceleration(0, 0);
+					for(int y = 0; y < 3; y++)
+						for(int x = 0; x < 3; x++)
+						{
+							Vec2 a = field[(y0 + y) * meshSize + x0 + x];
+							acceleration += a * (wx[x] * wy[y]);
+						}
+					accelerations[i] = acceleration;
+				}
+			});
+		}
+		
+		// adds (exact - softened) acceleration for the pairs closer than shortRangeRadius cells
+		void correctShortRange(const Vec2* positions, const float* bodyMasses, int count, Vec2* accelerations)
+		{
+			if(nextInCellCapacity < count)
+			{
+				delete[] nextInCell;
+				nextInCell = new int[count];
+				nextInCellCapacity = count;
+			}
+			
+			// bin the bodies into the mesh cells
+			for(int i = 0; i < (meshSize * meshSize); i++)
+				cellHeads[i] = -1;
+			for(int i = 0; i < count; i++)
+			{
+				Vec2 position = positions[i];
+				if(!isOnMesh(position)) continue;
+				int cell = (int)((position.y - origin.y) / cellSize) * meshSize + (int)((position.x - origin.x) / cellSize);
+				nextInCell[i] = cellHeads[cell];
+				cellHeads[cell] = i;
+			}
+			
+			int range = (int)ceil(shortRangeRadius);
+			float sqrRadius = shortRangeRadius * shortRangeRadius * cellSize * cellSize;
+			float softening = cellSize * cellSize;
+			parallelFor(count, threadCount, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					Vec2 position = positions[i];
+					if(!isOnMesh(position)) continue;
+					int cx = (int)((position.x - origin.x) / cellSize);
+					int cy = (int)((position.y - origin.y) / cellSize);
+					Vec2 correction(0, 0);
+					for(int y = cy - range; y <= (cy + range); y++)
+					{
+						if((y < 0) || (y >= meshSize)) continue;
+						for(int x = cx - range; x <= (cx + range); x++)
+						{
+							if((x < 0) || (x >= meshSize)) continue;
+							for(int j = cellHeads[y * meshSize + x]; j != -1; j = nextInCell[j])
+							{
+								if(i == j) continue;
+								Vec2 other = positions[j];
+								Vec2 d(other.x - position.x, other.y - position.y);
+								float sqrDistance = d.sqrMagnitude();
+								if((sqrDistance >= sqrRadius) || (sqrDistance == 0)) continue;
+								float exact = 1 / (sqrDistance * sqrt(sqrDistance));
+								float softened = 1 / ((sqrDistance + softening) * sqrt(sqrDistance + softening));
+								correction += d * (GRAVITATIONAL_CONSTANT * bodyMasses[j] * (exact - softened));
+							}
+						}
+					}
+					accelerations[i] += correction;
+				}
+			});
+		}
+		
+	public:
+		ParticleMeshSolver(int _meshSize = 128) : massAssignment(TRIANGULAR_SHAPED_CLOUD), meshSize(validMeshSize(_meshSize)), shortRangeCorrection(false), shortRangeRadius(3),
+			threadCount(0), masses(NULL), massMeshCount(0), densitySpectrum(NULL), kernelSpectrum(NULL), field(NULL), cellHeads(NULL),
+			nextInCell(NULL), nextInCellCapacity(0), domainSize(0), cellSize(1), meshMass(0), kernelCellSize(0) { }
+		ParticleMeshSolver(const ParticleMeshSolver&) = delete;
+		ParticleMeshSolver& operator =(const ParticleMeshSolver&) = delete;
+		
+		~ParticleMeshSolver()
+		{
+			releaseMeshes();
+			delete[] nextInCell;
+			nextInCell = NULL;
+		}
+		
+		// writes the gravitational acceleration of every body into accelerations
+		void computeAccelerations(const Vec2* positions, const float* bodyMasses, int count, Vec2* accelerations)
+		{
+			if(count <= 0) return;
+			
+			int workerCount = (threadCount > 0) ? threadCount : getWorkerCount();
+			allocateMeshes(min(workerCount, count));
+			placeMesh(positions, count);
+			computeMeshMass(positions, bodyMasses, count);
+			deposit(positions, bodyMasses, count);
+			computeKernelSpectrum();
+			solvePotential();
+			interpolate(positions, count, accelerations);
+			if(shortRangeCorrection)
+				correctShortRange(positions, bodyMasses, count, accelerations);
+		}
+		
+		// setters
+		void setMassAssignment(MassAssignment massAssignment) { this->massAssignment = massAssignment; }
+		void setMeshSize(int meshSize) { releaseMeshes(); this->meshSize = validMeshSize(meshSize); }
+		void setShortRangeCorrection(bool enabled, float radius = 3) { shortRangeCorrection = enabled; shortRangeRadius = radius; }
+		void setThreadCount(int threadCount) { this->threadCount = threadCount; }
+		void setDomainSize(float domainSize) { this->domainSize = domainSize; }
+		
+		// getters
+		MassAssignment getMassAssignment() const { return massAssignment; }
+		int getMeshSize() const { return meshSize; }
+		bool getShortRangeCorrection() const { return shortRangeCorrection; }
+		float getCellSize() const { return cellSize; }
+		float getDomainSize() const { return domainSize; }
+};
+
+
+// Gravity Simulator
+struct GravitySimulator
+{
+	public:
+		enum Solver
+		{
+			DIRECT_SUMMATION,	// O(n * n) pairwise forces
+			PARTICLE_MESH		// O(n + m log m) mesh forces, see ParticleMeshSolver
+		};
+		
+		enum SpaceFillingCurve
+		{
+			MORTON_CURVE,
+			HILBERT_CURVE
+		};
+		
+	private:
+		typedef Rigidbody* PtrRigidbody;
+	
+		// buffer
+		PtrRigidbody* rigidbodies;
+		// acceleration buffer, same capacity as the rigidbody buffer
+		Vec2* accelerations;
+		// positions, velocities and masses of the rigidbodies, slot i belongs to rigidbodies[i] (same capacity)
+		BodyStorage storage;
+		// number of rigidbodies
+		int rigidbodyCount;
+		
+		// capacity of the rigidbody buffer
+		int capacity;
+		
+		// force calculation method
+		Solver solver;
+		ParticleMeshSolver particleMesh;
+		
+		// the rigidbody buffer (and the storage) is sorted along the curve every reorderInterval steps (0 = never)
+		SpaceFillingCurve curve;
+		int reorderInterval;
+		int stepsSinceReorder;
+		
+		// reallocates array to newCapacity elements, keeping the first count ones
+		template<typename T>
+		static void resizeArray(T*& array, int count, int newCapacity)
+		{
+			T* newArray = new T[newCapacity];
+			for(int i = 0; i < count; i++)
+				newArray[i] = array[i];
+			if(array != NULL)
+				delete[] array;
+			array = newArray;
+		}
+		
+		// replaces array by array[order[0]], array[order[1]], ...
+		template<typename T>
+		static void permuteArray(T*& array, const int* order, int count, int capacity)
+		{
+			T* newArray = new T[capacity];
+			for(int i = 0; i < count; i++)
+				newArray[i] = array[order[i]];
+			delete[] array;
+			array = newArray;
+		}
+		
+		void resizeBuffer(int newCapacity)
+		{
+			// if the new capacity equals to the previous capacity then do nothing
+			if(newCapacity == capacity) return;
+			
+			// the rigidbodies which don't fit anymore take their state back
+			for(int i = newCapacity; i < rigidbodyCount; i++)
+				rigidbodies[i]->detach();
+			int copyCount = min(newCapacity, rigidbodyCount);
+			
+			// resize the acceleration buffer, its contents are recomputed every step
+			if(accelerations != NULL)
+				delete[] accelerations;
+			accelerations = new Vec2[newCapacity];
+			
+			// resize the storage, the attached transforms keep pointing to it
+			resizeArray(storage.positions, copyCount, newCapacity);
+			resizeArray(storage.previousPositions, copyCount, newCapacity);
+			resizeArray(storage.velocities, copyCount, newCapacity);
+			resizeArray(storage.masses, copyCount, newCapacity);
+			
+			// allocate another buffer
+			PtrRigidbody* newRigidbodies = new PtrRigidbody[newCapacity];
+			
+			if(rigidbodies != NULL)
+			{
+				// copy the already existing rigidbody references/ptrs
+				for(int i = 0; i < copyCount; i++)
+					newRigidbodies[i] = rigidbodies[i];
+				rigidbodyCount = copyCount;
+				// deallocate the previous buffer
+				delete[] rigidbodies;
+			}
+			
+			// set the rest of empty blocks to NULL
+			for(int i = rigidbodyCount; i < newCapacity; i++)
+				newRigidbodies[i] = NULL;
+			
+			// replace the old buffer with the new one
+			rigidbodies = newRigidbodies;
+			capacity = newCapacity;
+		}
 	
 	public:
-		GravitySimulator(int _capacity = 10) : rigidbodies(NULL), rigidbodyCount(0)
+		GravitySimulator(int _capacity = 10) : rigidbodies(NULL), accelerations(NULL), rigidbodyCount(0), capacity(0),
+			solver(DIRECT_SUMMATION), curve(MORTON_CURVE), reorderInterval(0), stepsSinceReorder(0)
 		{
+			storage.owner = this;
 			resizeBuffer(_capacity);
 		}
 		GravitySimulator(const GravitySimulator&) = delete;
 		GravitySimulator& operator =(const GravitySimulator&) = delete;
 		
+		// the rigidbodies still in the buffer take their state back (a destroyed rigidbody has already left the buffer)
 		~GravitySimulator()
 		{
+			for(int i = 0; i < rigidbodyCount; i++)
+				rigidbodies[i]->detach();
 			if(rigidbodies != NULL)
 				delete[] rigidbodies;
 			rigidbodies = NULL;
+			if(accelerations != NULL)
+				delete[] accelerations;
+			accelerations = NULL;
+			delete[] storage.positions;
+			delete[] storage.previousPositions;
+			delete[] storage.velocities;
+			delete[] storage.masses;
+			storage = BodyStorage();
+		}
+		
+		void addRigidbody(Rigidbody* rigidbody)
+		{
+			// if the capacity is not enough to accomodate the new rigidbody then increase the capacity 2 times
+			if(capacity < (rigidbodyCount + 1))
+			{
+				int newCapacity = capacity;
+				if(newCapacity == 0)
+					newCapacity = 2;
+				else
+					newCapacity *= 2;
+				resizeBuffer(newCapacity);
+			}
+			
+			// add the rigidbody, its state moves into the storage
+			rigidbodies[rigidbodyCount] = rigidbody;
+			rigidbody->attach(&storage, rigidbodyCount);
+			++rigidbodyCount;
+		}
+		
+		void removeRigidbody(Rigidbody* rigidbody)
+		{
+			for(int i = 0; i < rigidbodyCount; i++)
+			{
+				if(rigidbodies[i] == rigidbody)
+				{
+					rigidbody->detach();
+					// shift the rest of the rigidbodies (and their slots) to the left obscuring the rigidbody to be removed
+					for(int j = i + 1; j < rigidbodyCount; j++)
+					{
+						rigidbodies[j - 1] = rigidbodies[j];
+						storage.positions[j - 1] = storage.positions[j];
+						storage.previousPositions[j - 1] = storage.previousPositions[j];
+						storage.velocities[j - 1] = storage.velocities[j];
+						storage.masses[j - 1] = storage.masses[j];
+						rigidbodies[j - 1]->getTransform()->setBodyIndex(j - 1);
+					}
+					rigidbodyCount--;
+					rigidbodies[rigidbodyCount] = NULL;
+					return;
+				}
+			}
+			std::cout << "[Warning]: you're trying to remove a rigidbody which doesn't exist in the Rigidbody Buffer\n";
+		}
+		
+		// sorts the rigidbody buffer and the storage along the space filling curve over the bounding box of the
+		// bodies, so that bodies close in space are also close in memory, the transforms are given their new slots
+		// the rigidbodies themselves don't move in memory, so the pointers held by colliders and objects stay valid
+		void reorder()
+		{
+			if(rigidbodyCount < 2) return;
+			const Vec2* positions = storage.positions;
+			
+			Vec2 minCorner = positions[0];
+			Vec2 maxCorner = positions[0];
+			for(int i = 1; i < rigidbodyCount; i++)
+			{
+				minCorner.x = min(minCorner.x, positions[i].x);
+				minCorner.y = min(minCorner.y, positions[i].y);
+				maxCorner.x = max(maxCorner.x, positions[i].x);
+				maxCorner.y = max(maxCorner.y, positions[i].y);
+			}
+			float extent = max(maxCorner.x - minCorner.x, maxCorner.y - minCorner.y);
+			float scale = (extent > 0) ? 65535.0f / extent : 0;
+			
+			uint32_t* keys = new uint32_t[rigidbodyCount * 2];
+			int* order = new int[rigidbodyCount * 2];
+			SpaceFillingCurve curve = this->curve;
+			parallelFor(rigidbodyCount, 0, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					uint32_t x = (uint32_t)((positions[i].x - minCorner.x) * scale);
+					uint32_t y = (uint32_t)((positions[i].y - minCorner.y) * scale);
+					keys[i] = (curve == MORTON_CURVE) ? mortonKey(x, y) : hilbertKey(x, y);
+					order[i] = i;
+				}
+			});
+			radixSort(keys, order, keys + rigidbodyCount, order + rigidbodyCount, rigidbodyCount, 0);
+			
+			permuteArray(rigidbodies, order, rigidbodyCount, capacity);
+			permuteArray(storage.positions, order, rigidbodyCount, capacity);
+			permuteArray(storage.previousPositions, order, rigidbodyCount, capacity);
+			permuteArray(storage.velocities, order, rigidbodyCount, capacity);
+			permuteArray(storage.masses, order, rigidbodyCount, capacity);
+			for(int i = 0; i < rigidbodyCount; i++)
+				rigidbodies[i]->getTransform()->setBodyIndex(i);
+			for(int i = rigidbodyCount; i < capacity; i++)
+				rigidbodies[i] = NULL;
+			
+			delete[] keys;
+			delete[] order;
+			stepsSinceReorder = 0;
+		}
+		
+		// writes the gravitational acceleration of every rigidbody (in the rigidbody buffer order) into accelerations,
+		// without moving them
+		void computeAccelerations(Vec2* accelerations)
+		{
+			if(solver == PARTICLE_MESH)
+			{
+				particleMesh.computeAccelerations(storage.positions, storage.masses, rigidbodyCount, accelerations);
+				return;
+			}
+			
+			const Vec2* positions = storage.positions;
+			const float* masses = storage.masses;
+			int count = rigidbodyCount;
+			parallelFor(count, 0, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					Vec2 position = positions[i];
+					Vec2 acceleration(0, 0);
+					for(int j = 0; j < count; j++)
+					{
+						if(i == j) continue;
+						Vec2 radiusVector = position - positions[j];
+						float squaredDistance = radiusVector.sqrMagnitude();
+						acceleration += radiusVector.normalized() * (GRAVITATIONAL_CONSTANT * masses[j] / squaredDistance);
+					}
+					accelerations[i] = acceleration;
+				}
+			});
+		}
+		
+		// all the accelerations are computed from the same snapshot of the positions, then every body is moved
+		// (directly in the storage, semi-implicit Euler: velocity first, then the position with the new velocity)
+		void simulate(float deltaTime)
+		{
+			if((reorderInterval > 0) && (++stepsSinceReorder >= reorderInterval))
+				reorder();
+			
+			computeAccelerations(accelerations);
+			Vec2* positions = storage.positions;
+			Vec2* previousPositions = storage.previousPositions;
+			Vec2* velocities = storage.velocities;
+			Vec2* accelerations = this->accelerations;
+			parallelFor(rigidbodyCount, 0, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					previousPositions[i] = positions[i];
+					velocities[i] += accelerations[i] * deltaTime;
+					positions[i] += velocities[i] * deltaTime;
+				}
+			});
+		}
+
+		// setters
+		void setSolver(Solver solver) { this->solver = solver; }
+		void setSpaceFillingCurve(SpaceFillingCurve curve) { this->curve = curve; }
+		void setReorderInterval(int reorderInterval) { this->reorderInterval = reorderInterval; }
+		
+		// getters
+		Solver getSolver() const { return solver; }
+		SpaceFillingCurve getSpaceFillingCurve() const { return curve; }
+		int getReorderInterval() const { return reorderInterval; }
+		ParticleMeshSolver* getParticleMeshSolver() { return &particleMesh; }
+		int getRigidbodyCount() const { return rigidbodyCount; }
+		const PtrRigidbody* getRigidbodyBuffer() const { return rigidbodies; }
+		const BodyStorage* getStorage() const { return &storage; }
+};
+
+
+Rigidbody::~Rigidbody()
+{
+	BodyStorage* storage = transform->getStorage();
+	if(storage != NULL)
+		storage->owner->removeRigidbody(this);
+}
+
+
+// fixed timestep driver
+// accumulates real (monotonic) time and tells how many fixed physics steps to run in the current frame,
+// rendering is then interpolated between the last two physics states using getAlpha()
+struct FixedTimestep
+{
+	private:
+		typedef std::chrono::steady_clock Clock;
+		
+		// duration of one physics step (in seconds)
+		double stepSize;
+		
+		// maximum number of physics steps per frame, the rest of the backlog is dropped (prevents the spiral of death)
+		int maxSubsteps;
+		
+		// duration of one rendered frame (in seconds)
+		double frameInterval;
+		
+		// real time not yet consumed by the physics steps (in seconds)
+		double accumulator;
+		
+		Clock::time_point previousTime;
+		Clock::time_point nextFrameDeadline;
+		
+	public:
+		FixedTimestep(float _stepSize, float _frameInterval, int _maxSubsteps = 5) : stepSize(_stepSize), maxSubsteps(_maxSubsteps), frameInterval(_frameInterval), accumulator(0)
+		{
+			previousTime = Clock::now();
+			nextFrameDeadline = previousTime;
+		}
+		FixedTimestep(const FixedTimestep&) = delete;
+		FixedTimestep& operator =(const FixedTimestep&) = delete;
+		
+		// consumes the real time elapsed since the previous call, returns the number of physics steps to run now
+		int beginFrame()
+		{
+			Clock::time_point now = Clock::now();
+			accumulator += std::chrono::duration<double>(now - previousTime).count();
+			previousTime = now;
+			
+			int stepCount = (int)(accumulator / stepSize);
+			if(stepCount > maxSubsteps)
+			{
+				// can't keep up, let the simulated time run slow rather than falling further behind
+				accumulator = fmod(accumulator, stepSize) + maxSubsteps * stepSize;
+				stepCount = maxSubsteps;
+			}
+			accumulator -= stepCount * stepSize;
+			return stepCount;
+		}
+		
+		// fraction of a physics step left in the accumulator, in [0, 1)
+		float getAlpha() const { return (float)(accumulator / stepSize); }
+		
+		// sleeps until the deadline of the next frame
+		void waitForNextFrame()
+		{
+			nextFrameDeadline += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(frameInterval));
+			
+			// if the frame overran its deadline then don't try to catch up, start the next frame right away
+			Clock::time_point now = Clock::now();
+			if(nextFrameDeadline < now)
+			{
+				nextFrameDeadline = now;
+				return;
+			}
+#if HAS_STD_THREAD
+			std::this_thread::sleep_until(nextFrameDeadline);
+#else
+			// whole milliseconds only, rounded down so that the deadline is not overshot
+			Sleep((DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(nextFrameDeadline - now).count());
+#endif
+		}
+		
+		// getters
+		float getStepSize() const { return (float)stepSize; }
+		int getMaxSubsteps() const { return maxSubsteps; }
+};
+
+struct CirclePhysicalObject
+{
+	private:
+		Rigidbody* rigidbody;
+		CircleCollider* collider;
+		Transform* transform;
+	public:
+		CirclePhysicalObject(const CirclePhysicalObject&) = delete;
+		CirclePhysicalObject& operator =(const CirclePhysicalObject&) = delete;
+		
+		CirclePhysicalObject(float radius)
+		{
+			transform = new Transform();
+			rigidbody = new Rigidbody(transform, 1);
+			collider = new CircleCollider(rigidbody, radius);
+		}
+		~CirclePhysicalObject()
+		{
+			delete rigidbody;
+			delete collider;
+			delete transform;
+		}
+		
+		// getters
+		Transform* getTransform() const { return transform; }
+		Rigidbody* getRigidbody() const { return rigidbody; }
+		CircleCollider* getCollider() const { return collider; }
+};
+
+// initial state of a body produced by the InitialConditionGenerator
+struct BodyState
+{
+	Vec2 position;
+	Vec2 velocity;
+	float mass;
+};
+
+// generates standard initial distributions of bodies in parallel
+// body 'i' always draws from the random stream (seed, i), so the output for a given seed
+// is identical regardless of the number of threads used
+struct InitialConditionGenerator
+{
+	private:
+		// sub streams, so that different distributions don't share random numbers for the same body index
+		enum { UNIFORM_BOX_STREAM = 1, KEPLERIAN_DISK_STREAM = 2, PLUMMER_SPHERE_STREAM = 3 };
+	
+		// seed of all the random streams
+		uint32_t seed;
+		
+		// number of threads to use, <= 0 means all the hardware threads
+		int threadCount;
+		
+	public:
+		InitialConditionGenerator(uint32_t _seed, int _threadCount = 0) : seed(_seed), threadCount(_threadCount) { }
+		
+		// setters
+		void setSeed(uint32_t seed) { this->seed = seed; }
+		void setThreadCount(int threadCount) { this->threadCount = threadCount; }
+		
+		// getters
+		uint32_t getSeed() const { return seed; }
+		int getThreadCount() const { return threadCount; }
+		
+		// bodies at rest, uniformly distributed in the box [minCorner, maxCorner]
+		// states[i] is generated from the stream of body (firstIndex + i)
+		void generateUniformBox(BodyState* states, int firstIndex, int count, Vec2 minCorner, Vec2 maxCorner, float mass) const
+		{
+			uint32_t seed = this->seed;
+			parallelFor(count, threadCount, [=](int begin, int end)
+			{
+				for(int i = begin; i < end; i++)
+				{
+					RandomStream random(seed, (uint32_t)(firstIndex + i), UNIFORM_BOX_STREAM);
+					float x = random.nextFloat(minCorner.x, maxCorner.x);
+					float y = random.nextFloat(minCorner.y, maxCorner.y);
+					states[i].position = Vec2(x, y);
+					states[i].velocity = Vec2(0, 0);
+					states[i].mass = mass;
+				}
+			});
+		}
+		
+		// bodies uniformly distributed (per unit area) in the annulus [innerRadius, outerRadius] around 'center',
+		// moving anticlockwise on circular orbits around a central mass
+		void generateKeplerianDisk(BodyState* states, int firstIndex, int count, Vec2 center, float centralMass, float innerRadius, float outerRadius, float mass) const
+		{
+			uint32_t seed = this->seed;
+			parallelFor(count, threadCount, [=](int begin, int end)
+			{
+				float sqrInnerRadius = innerRadius * innerRadius;
+				float sqrOuterRadius = outerRadius * outerRadius;
+				for(int i = begin; i < end; i++)
+				{
+					RandomStream random(seed, (uint32_t)(firstIndex + i), KEPLERIAN_DISK_STREAM);
+					float radius = sqrt(random.nextFloat(sqrInnerRadius, sqrOuterRadius));
+					float angle = random.nextFloat(0, 2 * PI);
+					Vec2 direction(cos(angle), sin(angle));
+					
+					// circular orbit: v * v / r = G * M / (r * r)
+					float speed = sqrt(GRAVITATIONAL_CONSTANT * centralMass / radius);
+					states[i].position = Vec2(center.x + direction.x * radius, center.y + direction.y * radius);
+					states[i].velocity = Vec2(-direction.y * speed, direction.x * speed);
+					states[i].mass = mass;
+				}
+			});
+		}
+		
+		// plummer sphere projected onto the simulation plane (Aarseth, Henon & Wielen 1974)
+		// totalMass is shared equally by the 'count' bodies, radii are truncated at 10 * scaleRadius
+		void generatePlummerSphere(BodyState* states, int firstIndex, int count, Vec2 center, float totalMass, float scaleRadius) const
+		{
+			uint32_t seed = this->seed;
+			parallelFor(count, threadCount, [=](int begin, int end)
+			{
+				float mass = totalMass / count;
+				for(int i = begin; i < end; i++)
+				{
+					RandomStream random(seed, (uint32_t)(firstIndex + i), PLUMMER_SPHERE_STREAM);
+					
+					// radius from the inverse of the cumulative mass profile
+					float radius;
+					do
+					{
+						radius = scaleRadius / sqrt(pow(random.nextFloat(), -2.0f / 3.0f) - 1);
+					} while(radius > (10 * scaleRadius));
+					
+					// isotropic direction, only x and y are kept
+					float cosTheta = random.nextFloat(-1, 1);
+					float sinTheta = sqrt(1 - cosTheta * cosTheta);
+					float phi = random.nextFloat(0, 2 * PI);
+					states[i].position = Vec2(center.x + radius * sinTheta * cos(phi), center.y + radius * sinTheta * sin(phi));
+					
+					// speed as a fraction q of the escape speed, g(q) = q^2 * (1 - q^2)^3.5 by rejection sampling
+					float q, g;
+					do
+					{
+						q = random.nextFloat();
+						g = random.nextFloat(0, 0.1f);
+					} while(g > (q * q * pow(1 - q * q, 3.5f)));
+					float escapeSpeed = sqrt(2 * GRAVITATIONAL_CONSTANT * totalMass) * pow(radius * radius + scaleRadius * scaleRadius, -0.25f);
+					float speed = q * escapeSpeed;
+					
+					cosTheta = random.nextFloat(-1, 1);
+					sinTheta = sqrt(1 - cosTheta * cosTheta);
+					phi = random.nextFloat(0, 2 * PI);
+					states[i].velocity = Vec2(speed * sinTheta * cos(phi), speed * sinTheta * sin(phi));
+					states[i].mass = mass;
+				}
+			});
+		}
+};
+
+struct Context
+{
+private:
+	Vec2Int screenSize; 		// size of the window in pixel coordinates
+	Vec2 worldSize; 			// size of the world in meters (Rectangular coordinates)
+
+
+public:	
+	Context(Vec2Int _screenSize, float worldWidth) : screenSize(_screenSize)
+	{
+		worldSize.x = worldWidth;
+		worldSize.y = worldWidth * screenSize.y / screenSize.x;
+	}
+	
+	// getters
+	Vec2Int getScreenSize() const { return screenSize; }
+	Vec2 getWorldSize() const { return worldSize; }
+	
+	// converts screen coordinates into world coordinates
+	Vec2 screenToWorldCoordinates(int xScreen, int yScreen) const
+	{
+		yScreen *= -1;
+		xScreen += screenSize.x * 0.5f;
+		yScreen += screenSize.y * 0.5f;
+		float x = worldSize.x * xScreen / screenSize.x;
+		float y = worldSize.y * yScreen / screenSize.y;
+		return { x , y };
+	}
+	
+	Vec2Int worldToScreenCoordinates(const Vec2& world)
+	{
+		return worldToScreenCoordinates(world.x, world.y);
+	}
+	// converts world coordinates into screen coordinates
+	Vec2Int worldToScreenCoordinates(float xWorld, float yWorld) const
+	{
+		int x = screenSize.x * xWorld / worldSize.x;
+		int y = -screenSize.y * yWorld / worldSize.y;
+		return { x + screenSize.x * 0.5f, y + screenSize.y * 0.5f };
+	}
+};
+
+static void drawTrajectory(int count, int* const buffer)
+{
+	setcolor(YELLOW);
+	setlinestyle(DOTTED_LINE, 1, NORM_WIDTH);
+	
+	drawpoly(count, buffer);
+}
+
+
+// alpha interpolates between the last two physics states (see FixedTimestep::getAlpha)
+void renderObjects(Context* context, CircleCollider* const* colliders, int colliderCount, float alpha)
+{
+	for(int i = 0; i < colliderCount; i++)
+	{
+		// render each object
+		Vec2 position = colliders[i]->getRigidbody()->getTransform()->getInterpolatedPosition(alpha);
+   		Vec2Int screenPos = context->worldToScreenCoordinates(position);
+   		arc(screenPos.x, screenPos.y, 0, 360, colliders[i]->getRadius());
+   	}
+}
+
+// history of the last positions of every body, drawn as trails
+// all the trails share one ring buffer arena of historyLength samples per slot; a collider is given a slot the first
+// time it is recorded (see CircleCollider::getTrailSlot), and loses it as soon as a record doesn't contain it anymore,
+// so removing colliders from the buffer doesn't mix the trails up; before drawing, every trail is simplified
+// (Ramer-Douglas-Peucker) so that no dropped sample is further than 'tolerance' pixels from the drawn polyline
+struct TrailHistory
+{
+	private:
+		// number of samples kept per trail
+		int historyLength;
+		
+		// ring buffer arena, capacity * historyLength samples
+		Vec2* samples;
+		// per slot index of the next sample to write, and number of valid samples
+		int* nextSamples;
+		int* sampleCounts;
+		// per slot collider (NULL = free) and number of the last record which contained it
+		const CircleCollider** owners;
+		int* lastRecords;
+		
+		// number of slots, free slots (a stack), and number of records so far
+		int capacity;
+		int* freeSlots;
+		int freeSlotCount;
+		int recordCount;
+		
+		// maximum distance (in pixels) between a dropped sample and the drawn polyline
+		float tolerance;
+		
+		// decimation scratch buffers, historyLength + 1 points (the samples plus the rendered position)
+		Vec2Int* points;
+		bool* keep;
+		int* stack;
+		int* polygon;
+		
+		void resizeBuffer(int newCapacity)
+		{
+			Vec2* newSamples = new Vec2[newCapacity * historyLength];
+			int* newNextSamples = new int[newCapacity];
+			int* newSampleCounts = new int[newCapacity];
+			const CircleCollider** newOwners = new const CircleCollider*[newCapacity];
+			int* newLastRecords = new int[newCapacity];
+			int* newFreeSlots = new int[newCapacity];
+			
+			// copy the existing trails
+			int copyCount = min(newCapacity, capacity);
+			for(int i = 0; i < (copyCount * historyLength); i++)
+				newSamples[i] = samples[i];
+			for(int i = 0; i < copyCount; i++)
+			{
+				newNextSamples[i] = nextSamples[i];
+				newSampleCounts[i] = sampleCounts[i];
+				newOwners[i] = owners[i];
+				newLastRecords[i] = lastRecords[i];
+			}
+			for(int i = 0; i < freeSlotCount; i++)
+				newFreeSlots[i] = freeSlots[i];
+			
+			// the new slots are empty, and free with the lowest one on top
+			for(int i = copyCount; i < newCapacity; i++)
+			{
+				newNextSamples[i] = 0;
+				newSampleCounts[i] = 0;
+				newOwners[i] = NULL;
+				newLastRecords[i] = 0;
+			}
+			for(int i = newCapacity - 1; i >= copyCount; i--)
+				newFreeSlots[freeSlotCount++] = i;
+			
+			delete[] samples;
+			delete[] nextSamples;
+			delete[] sampleCounts;
+			delete[] owners;
+			delete[] lastRecords;
+			delete[] freeSlots;
+			samples = newSamples;
+			nextSamples = newNextSamples;
+			sampleCounts = newSampleCounts;
+			owners = newOwners;
+			lastRecords = newLastRecords;
+			freeSlots = newFreeSlots;
+			capacity = newCapacity;
+		}
+		
+		// slot of the trail of the collider, -1 if it has none
+		int findSlot(const CircleCollider* collider) const
+		{
+			int slot = collider->getTrailSlot();
+			return ((slot >= 0) && (slot < capacity) && (owners[slot] == collider)) ? slot : -1;
+		}
+		
+		// distance (in pixels) of p from the segment [a, b]
+		static float distanceToSegment(Vec2Int p, Vec2Int a, Vec2Int b)
+		{
+			float dx = (float)(b.x - a.x), dy = (float)(b.y - a.y);
+			float px = (float)(p.x - a.x), py = (float)(p.y - a.y);
+			float sqrLength = dx * dx + dy * dy;
+			float t = (sqrLength > 0) ? (px * dx + py * dy) / sqrLength : 0;
+			t = max(0.0f, min(1.0f, t));
+			px -= t * dx;
+			py -= t * dy;
+			return sqrt(px * px + py * py);
+		}
+		
+		// simplifies points[0, count) into polygon, returns the number of vertices written
+		int decimate(int count)
+		{
+			for(int i = 0; i < count; i++)
+				keep[i] = false;
+			keep[0] = true;
+			keep[count - 1] = true;
+			
+			// iterative Ramer-Douglas-Peucker, the stack holds [first, last] ranges
+			int top = 0;
+			stack[top++] = 0;
+			stack[top++] = count - 1;
+			while(top > 0)
+			{
+				int last = stack[--top];
+				int first = stack[--top];
+				float maxDistance = 0;
+				int farthest = -1;
+				for(int i = first + 1; i < last; i++)
+				{
+					float distance = distanceToSegment(points[i], points[first], points[last]);
+					if(distance > maxDistance)
+					{
+						maxDistance = distance;
+						farthest = i;
+					}
+				}
+				if(maxDistance > tolerance)
+				{
+					keep[farthest] = true;
+					stack[top++] = first;
+					stack[top++] = farthest;
+					stack[top++] = farthest;
+					stack[top++] = last;
+				}
+			}
+			
+			int vertexCount = 0;
+			for(int i = 0; i < count; i++)
+			{
+				if(!keep[i]) continue;
+				polygon[vertexCount * 2] = points[i].x;
+				polygon[vertexCount * 2 + 1] = points[i].y;
+				++vertexCount;
+			}
+			return vertexCount;
+		}
+		
+	public:
+		TrailHistory(int _historyLength = 64, float _tolerance = 1.0f) : historyLength(_historyLength), samples(NULL), nextSamples(NULL), sampleCounts(NULL),
+			owners(NULL), lastRecords(NULL), capacity(0), freeSlots(NULL), freeSlotCount(0), recordCount(0), tolerance(_tolerance)
+		{
+			points = new Vec2Int[historyLength + 1];
+			keep = new bool[historyLength + 1];
+			stack = new int[(historyLength + 1) * 2];
+			polygon = new int[(historyLength + 1) * 2];
+		}
+		TrailHistory(const TrailHistory&) = delete;
+		TrailHistory& operator =(const TrailHistory&) = delete;
+		
+		~TrailHistory()
+		{
+			delete[] samples;
+			delete[] nextSamples;
+			delete[] sampleCounts;
+			delete[] owners;
+			delete[] lastRecords;
+			delete[] freeSlots;
+			delete[] points;
+			delete[] keep;
+			delete[] stack;
+			delete[] polygon;
+		}
+		
+		// appends the current position of every collider to its trail, the oldest sample is overwritten when the trail is full
+		// the trails of the colliders which are not in the buffer anymore are dropped
+		void record(CircleCollider* const* colliders, int colliderCount)
+		{
+			++recordCount;
+			for(int i = 0; i < colliderCount; i++)
+			{
+				int slot = findSlot(colliders[i]);
+				if(slot < 0)
+				{
+					// grow the arena 2 times when there is no free slot left
+					if(freeSlotCount == 0)
+						resizeBuffer((capacity == 0) ? 2 : capacity * 2);
+					slot = freeSlots[--freeSlotCount];
+					owners[slot] = colliders[i];
+					nextSamples[slot] = 0;
+					sampleCounts[slot] = 0;
+					colliders[i]->setTrailSlot(slot);
+				}
+				lastRecords[slot] = recordCount;
+				
+				samples[slot * historyLength + nextSamples[slot]] = colliders[i]->getRigidbody()->getTransform()->getPosition();
+				nextSamples[slot] = (nextSamples[slot] + 1) % historyLength;
+				if(sampleCounts[slot] < historyLength)
+					++sampleCounts[slot];
+			}
+			
+			for(int slot = 0; slot < capacity; slot++)
+				if((owners[slot] != NULL) && (lastRecords[slot] != recordCount))
+				{
+					owners[slot] = NULL;
+					freeSlots[freeSlotCount++] = slot;
+				}
+		}
+		
+		// forgets the trail of the collider, e.g. after its body has been teleported
+		void clear(const CircleCollider* collider)
+		{
+			int slot = findSlot(collider);
+			if(slot >= 0)
+				sampleCounts[slot] = 0;
+		}
+		
+		// draws every trail from its oldest sample to the rendered (interpolated) position of its body
+		void render(Context* context, CircleCollider* const* colliders, int colliderCount, float alpha)
+		{
+			for(int i = 0; i < colliderCount; i++)
+			{
+				int slot = findSlot(colliders[i]);
+				if(slot < 0) continue;
+				int sampleCount = sampleCounts[slot];
+				if(sampleCount == 0) continue;
+				
+				const Vec2* trail = samples + slot * historyLength;
+				int oldest = (nextSamples[slot] - sampleCount + historyLength) % historyLength;
+				for(int j = 0; j < sampleCount; j++)
+					points[j] = context->worldToScreenCoordinates(trail[(oldest + j) % historyLength]);
+				points[sampleCount] = context->worldToScreenCoordinates(colliders[i]->getRigidbody()->getTransform()->getInterpolatedPosition(alpha));
+				
+				int vertexCount = decimate(sampleCount + 1);
+				drawTrajectory(vertexCount, polygon);
+			}
+		}
+		
+		// setters
+		void setTolerance(float tolerance) { this->tolerance = tolerance; }
+		
+		// getters
+		int getHistoryLength() const { return historyLength; }
+		float getTolerance() const { return tolerance; }
+};
+
+
+#if defined(__linux__)
+// sharded (multi-process) simulation on one host
+// the world (Context::getWorldSize) is split along x into one strip (domain) per worker process; every step a worker
+// - publishes the moments (mass, first and second order) of its bodies on a coarse global grid
+// - sends its bodies lying in the columns next to every other domain's strip to that domain's inbox in shared memory
+// - computes exact forces from its own and the received (halo) bodies, and monopole + quadrupole forces from the
+//   grid cells of all the other columns
+// - integrates its bodies and hands the bodies which left its strip over to their new owner
+// the grid lines are quantiles of the bodies along x and y, and every strip is made of the same number of whole
+// columns, so the strips hold about the same number of bodies and the halo of a domain stays about 2 columns
+// (2 * count / columnCount bodies) however concentrated the bodies are; they are recomputed from histograms of the
+// bodies every rebalanceInterval steps
+// every domain has one bounded inbox per message kind, a worker which overflows one raises a flag and all the workers
+// give up at the following barrier, the run is then restarted with twice the capacity (see setInboxCapacity)
+struct ShardedSimulation
+{
+	private:
+		enum { GRID_SIZE = 32, HISTOGRAM_SIZE = 1024 };
+		
+		struct BodyRecord
+		{
+			uint32_t id;
+			Vec2 position;
+			Vec2 velocity;
+			float mass;
+		};
+		
+		// multiple producer inbox of a domain, filled before a barrier and drained by its owner after it
+		struct Inbox
+		{
+			std::atomic<uint32_t> count;
+		};
+		
+		// raw moments of the bodies of a grid cell, additive across domains
+		struct CellMoments
+		{
+			double mass, x, y, xx, xy, yy;
+		};
+		
+		// far field of a grid cell: total mass, center of mass and quadrupole tensor (xx, xy, yy)
+		struct Multipole
+		{
+			Vec2 center;
+			float mass;
+			float qxx, qxy, qyy;
+		};
+		
+		// shared memory segment, created before the workers are forked
+		struct Shared
+		{
+			pthread_barrier_t barrier;
+			std::atomic<int> overflowBarrier;	// number of the barrier following a push into a full inbox, 0 = none
+		};
+		
+		Vec2 worldSize;
+		int processCount;
+		int rebalanceInterval;
+		int inboxCapacity;		// 0 = default, see getInboxCapacity
+		int columnsPerStrip;
+		int columnCount;			// columnsPerStrip * processCount grid columns, GRID_SIZE grid rows
+		
+		// segment layout
+		void* segment;
+		size_t segmentSize;
+		Shared* shared;
+		CellMoments* summaries;		// processCount * GRID_SIZE * columnCount
+		int* histograms;			// processCount * 2 * HISTOGRAM_SIZE, along x then y
+		Inbox* inboxes;				// 2 inboxes (halo, migration) per domain
+		BodyRecord* inboxRecords;	// recordCapacity records per inbox
+		int recordCapacity;
+		BodyRecord* results;		// bodyCount records, initial bodies in and final bodies out
+		int bodyCount;
+		
+		// worker state (private to every process)
+		int domain;
+		int barrierCount;			// barriers passed so far
+		float* columnBounds;		// columnCount - 1 grid lines along x, every columnsPerStrip-th one is a strip boundary
+		float rowBounds[GRID_SIZE - 1];
+		BodyRecord* bodies;
+		int ownedCount;
+		BodyRecord* halo;
+		int haloCount;
+		Vec2* accelerations;
+		Multipole* farCells;
+		int farCellCount;
+		uint32_t* sortKeys;			// 2 * recordCapacity keys and recordCapacity records, see drain
+		BodyRecord* sortRecords;
+		
+		static size_t align(size_t size) { return (size + 63) & ~(size_t)63; }
+		
+		// number of bounds (sorted) lower than or equal to value
+		static int intervalOf(const float* bounds, int boundCount, float value)
+		{
+			int first = 0;
+			while(boundCount > 0)
+			{
+				int half = boundCount / 2;
+				if(bounds[first + half] <= value)
+				{
+					first += half + 1;
+					boundCount -= half + 1;
+				}
+				else
+					boundCount = half;
+			}
+			return first;
+		}
+		int columnOf(float x) const { return intervalOf(columnBounds, columnCount - 1, x); }
+		int rowOf(float y) const { return intervalOf(rowBounds, GRID_SIZE - 1, y); }
+		int ownerOf(float x) const { return columnOf(x) / columnsPerStrip; }
+		static int binOf(float x, float extent)
+		{
+			int bin = (int)((x / extent + 0.5f) * HISTOGRAM_SIZE);
+			return (bin < 0) ? 0 : ((bin >= HISTOGRAM_SIZE) ? HISTOGRAM_SIZE - 1 : bin);
+		}
+		
+		// the columns next to a strip are treated exactly too, so that no grid cell is too close to a body
+		int nearFirstColumn(int d) const { return max(d * columnsPerStrip - 1, 0); }
+		int nearLastColumn(int d) const { return min((d + 1) * columnsPerStrip, columnCount - 1); }
+		
+		// histogram of the bodies of this domain (or of the initial bodies), along x then y
+		void fillHistogram(int* histogram, const BodyRecord* records, int count) const
+		{
+			memset(histogram, 0, sizeof(int) * 2 * HISTOGRAM_SIZE);
+			for(int i = 0; i < count; i++)
+			{
+				++histogram[binOf(records[i].position.x, worldSize.x)];
+				++histogram[HISTOGRAM_SIZE + binOf(records[i].position.y, worldSize.y)];
+			}
+		}
+		
+		Inbox* getInbox(int to, int kind) const
+		{
+			return (Inbox*)((char*)inboxes + (to * 2 + kind) * align(sizeof(Inbox)));
+		}
+		BodyRecord* getInboxRecords(int to, int kind) const
+		{
+			return inboxRecords + (size_t)(to * 2 + kind) * recordCapacity;
+		}
+		
+		// the records are published by the next barrier
+		void push(int to, int kind, const BodyRecord& record)
+		{
+			uint32_t index = getInbox(to, kind)->count.fetch_add(1, std::memory_order_relaxed);
+			if(index < (uint32_t)recordCapacity)
+				getInboxRecords(to, kind)[index] = record;
+			else
+				shared->overflowBarrier.store(barrierCount + 1, std::memory_order_relaxed);
+		}
+		
+		// copies the records of an inbox of this domain into records and empties it, after the barrier
+		// the inbox isn't pushed to again before the next barrier, which its owner only reaches after this
+		// the producers race for the slots, so the records are sorted by id to keep the sums deterministic
+		int drain(int kind, BodyRecord* records)
+		{
+			Inbox* inbox = getInbox(domain, kind);
+			int count = min((int)inbox->count.load(std::memory_order_relaxed), recordCapacity);
+			const BodyRecord* inboxRecords = getInboxRecords(domain, kind);
+			for(int i = 0; i < count; i++)
+			{
+				records[i] = inboxRecords[i];
+				sortKeys[i] = inboxRecords[i].id;
+			}
+			inbox->count.store(0, std::memory_order_relaxed);
+			radixSort(sortKeys, records, sortKeys + recordCapacity, sortRecords, count, 1);
+			return count;
+		}
+		
+		// all the workers give up together at the barrier following an overflow (a faster worker may already
+		// overflow an inbox in the next phase while the others are leaving this barrier)
+		void wait()
+		{
+			pthread_barrier_wait(&shared->barrier);
+			++barrierCount;
+			int overflowBarrier = shared->overflowBarrier.load(std::memory_order_relaxed);
+			if((overflowBarrier != 0) && (overflowBarrier <= barrierCount))
+				_exit(2);
+		}
+		
+		// boundCount bounds splitting the bodies into boundCount + 1 intervals of equal counts, from the histograms
+		// (along x or y, see fillHistogram) of all the domains
+		static void computeQuantiles(const int* histograms, int histogramCount, int axis, float extent, float* bounds, int boundCount)
+		{
+			long long total = 0;
+			for(int h = 0; h < histogramCount; h++)
+				for(int bin = 0; bin < HISTOGRAM_SIZE; bin++)
+					total += histograms[(h * 2 + axis) * HISTOGRAM_SIZE + bin];
+			
+			long long accumulated = 0;
+			int bound = 0;
+			for(int bin = 0; (bin < HISTOGRAM_SIZE) && (bound < boundCount); bin++)
+			{
+				for(int h = 0; h < histogramCount; h++)
+					accumulated += histograms[(h * 2 + axis) * HISTOGRAM_SIZE + bin];
+				while((bound < boundCount) && (accumulated * (boundCount + 1) >= total * (bound + 1)))
+					bounds[bound++] = ((float)(bin + 1) / HISTOGRAM_SIZE - 0.5f) * extent;
+			}
+			for(; bound < boundCount; bound++)
+				bounds[bound] = extent * 0.5f;
+		}
+		
+		// grid lines (and so strip boundaries) with equal body counts
+		void computeGrid(const int* histograms, int histogramCount)
+		{
+			computeQuantiles(histograms, histogramCount, 0, worldSize.x, columnBounds, columnCount - 1);
+			computeQuantiles(histograms, histogramCount, 1, worldSize.y, rowBounds, GRID_SIZE - 1);
+		}
+		
+		void publish()
+		{
+			CellMoments* summary = summaries + domain * GRID_SIZE * columnCount;
+			memset(summary, 0, sizeof(CellMoments) * GRID_SIZE * columnCount);
+			for(int i = 0; i < ownedCount; i++)
+			{
+				const BodyRecord& body = bodies[i];
+				int column = columnOf(body.position.x);
+				CellMoments& cell = summary[rowOf(body.position.y) * columnCount + column];
+				double x = body.position.x, y = body.position.y, m = body.mass;
+				cell.mass += m;
+				cell.x += m * x;
+				cell.y += m * y;
+				cell.xx += m * x * x;
+				cell.xy += m * x * y;
+				cell.yy += m * y * y;
+				
+				// halo of the other domains
+				for(int d = 0; d < processCount; d++)
+					if((d != domain) && (column >= nearFirstColumn(d)) && (column <= nearLastColumn(d)))
+						push(d, 0, body);
+			}
+		}
+		
+		void gatherFarField()
+		{
+			haloCount = drain(0, halo);
+			
+			farCellCount = 0;
+			for(int row = 0; row < GRID_SIZE; row++)
+				for(int column = 0; column < columnCount; column++)
+				{
+					if((column >= nearFirstColumn(domain)) && (column <= nearLastColumn(domain))) continue;
+					CellMoments cell = { 0, 0, 0, 0, 0, 0 };
+					for(int d = 0; d < processCount; d++)
+					{
+						const CellMoments& partial = summaries[(d * GRID_SIZE + row) * columnCount + column];
+						cell.mass += partial.mass;
+						cell.x += partial.x;
+						cell.y += partial.y;
+						cell.xx += partial.xx;
+						cell.xy += partial.xy;
+						cell.yy += partial.yy;
+					}
+					if(cell.mass <= 0) continue;
+					
+					// central second moments, then the traceless quadrupole Q = sum m * (3 * d * d^T - |d|^2 * I)
+					double cx = cell.x / cell.mass, cy = cell.y / cell.mass;
+					double sxx = cell.xx - cell.mass * cx * cx;
+					double sxy = cell.xy - cell.mass * cx * cy;
+					double syy = cell.yy - cell.mass * cy * cy;
+					Multipole& far = farCells[farCellCount++];
+					far.center = Vec2((float)cx, (float)cy);
+					far.mass = (float)cell.mass;
+					far.qxx = (float)(3 * sxx - (sxx + syy));
+					far.qxy = (float)(3 * sxy);
+					far.qyy = (float)(3 * syy - (sxx + syy));
+				}
+		}
+		
+		static void addPairAcceleration(Vec2& acceleration, Vec2 position, Vec2 other, float mass)
+		{
+			float dx = other.x - position.x, dy = other.y - position.y;
+			float sqrDistance = dx * dx + dy * dy;
+			if(sqrDistance == 0) return;
+			float scale = GRAVITATIONAL_CONSTANT * mass / (sqrDistance * sqrt(sqrDistance));
+			acceleration.x += dx * scale;
+			acceleration.y += dy * scale;
+		}
+		
+		void computeAccelerations()
+		{
+			for(int i = 0; i < ownedCount; i++)
+			{
+				Vec2 position = bodies[i].position;
+				Vec2 acceleration(0, 0);
+				for(int j = 0; j < ownedCount; j++)
+					if(j != i)
+						addPairAcceleration(acceleration, position, bodies[j].position, bodies[j].mass);
+				for(int j = 0; j < haloCount; j++)
+					addPairAcceleration(acceleration, position, halo[j].position, halo[j].mass);
+				
+				// a = -G * M * r / r^3 + G * (Q * r / r^5 - 2.5 * (r^T * Q * r) * r / r^7), r from the center of mass
+				for(int c = 0; c < farCellCount; c++)
+				{
+					const Multipole& far = farCells[c];
+					float rx = position.x - far.center.x, ry = position.y - far.center.y;
+					float sqrDistance = rx * rx + ry * ry;
+					float inverseDistance = 1 / sqrt(sqrDistance);
+					float inverseDistance2 = inverseDistance * inverseDistance;
+					float inverseDistance3 = inverseDistance2 * inverseDistance;
+					float inverseDistance5 = inverseDistance3 * inverseDistance2;
+					float qrx = far.qxx * rx + far.qxy * ry;
+					float qry = far.qxy * rx + far.qyy * ry;
+					float rqr = rx * qrx + ry * qry;
+					float radial = -far.mass * inverseDistance3 - 2.5f * rqr * inverseDistance5 * inverseDistance2;
+					acceleration.x += GRAVITATIONAL_CONSTANT * (radial * rx + qrx * inverseDistance5);
+					acceleration.y += GRAVITATIONAL_CONSTANT * (radial * ry + qry * inverseDistance5);
+				}
+				accelerations[i] = acceleration;
+			}
+		}
+		
+		// hands the bodies which are not in this strip anymore over to their owners
+		void migrate()
+		{
+			int kept = 0;
+			for(int i = 0; i < ownedCount; i++)
+			{
+				int owner = ownerOf(bodies[i].position.x);
+				if(owner == domain)
+					bodies[kept++] = bodies[i];
+				else
+					push(owner, 1, bodies[i]);
+			}
+			ownedCount = kept;
+			wait();
+			
+			ownedCount += drain(1, bodies + ownedCount);
+		}
+		
+		void runWorker(int stepCount, float deltaTime)
+		{
+			bodies = new BodyRecord[bodyCount];
+			halo = new BodyRecord[recordCapacity];
+			sortKeys = new uint32_t[recordCapacity * 2];
+			sortRecords = new BodyRecord[recordCapacity];
+			accelerations = new Vec2[bodyCount];
+			farCells = new Multipole[GRID_SIZE * columnCount];
+			
+			// take the initial bodies of this strip
+			ownedCount = 0;
+			for(int i = 0; i < bodyCount; i++)
+				if(ownerOf(results[i].position.x) == domain)
+					bodies[ownedCount++] = results[i];
+			wait();
+			
+			int* histogram = histograms + domain * 2 * HISTOGRAM_SIZE;
+			for(int step = 0; step < stepCount; step++)
+			{
+				publish();
+				wait();
+				
+				gatherFarField();
+				computeAccelerations();
+				
+				// same integration as GravitySimulator::simulate
+				for(int i = 0; i < ownedCount; i++)
+				{
+					bodies[i].velocity += accelerations[i] * deltaTime;
+					bodies[i].position += bodies[i].velocity * deltaTime;
+				}
+				
+				if((rebalanceInterval > 0) && (((step + 1) % rebalanceInterval) == 0))
+				{
+					fillHistogram(histogram, bodies, ownedCount);
+					wait();
+					computeGrid(histograms, processCount);
+				}
+				migrate();
+			}
+			
+			for(int i = 0; i < ownedCount; i++)
+				results[bodies[i].id] = bodies[i];
+			
+			delete[] bodies;
+			delete[] halo;
+			delete[] accelerations;
+			delete[] farCells;
+			delete[] sortKeys;
+			delete[] sortRecords;
 		}
 		
-		void addRigidbody(Rigidbody* rigidbody)
+		// one run with recordCapacity records per inbox, see run, states is only written on success
+		// seconds is the wall clock time of the workers, overflowed is set if they gave up on a full inbox
+		bool launch(BodyState* states, int count, int stepCount, float deltaTime, double& seconds, bool& overflowed)
 		{
-			// if the capacity is not enough to accomodate the new rigidbody then increase the capacity 2 times
-			if(capacity < (rigidbodyCount + 1))
+			bodyCount = count;
+			int inboxCount = processCount * 2;
+			size_t sharedOffset = 0;
+			size_t summaryOffset = sharedOffset + align(sizeof(Shared));
+			size_t histogramOffset = summaryOffset + align(sizeof(CellMoments) * processCount * GRID_SIZE * columnCount);
+			size_t inboxOffset = histogramOffset + align(sizeof(int) * processCount * 2 * HISTOGRAM_SIZE);
+			size_t inboxRecordOffset = inboxOffset + align(sizeof(Inbox)) * inboxCount;
+			size_t resultOffset = inboxRecordOffset + align(sizeof(BodyRecord) * (size_t)recordCapacity * inboxCount);
+			segmentSize = resultOffset + align(sizeof(BodyRecord) * (size_t)bodyCount);
+			
+			// the name is unlinked right after mapping, the forked workers inherit the mapping
+			char name[64];
+			snprintf(name, sizeof(name), "/gravity_simulation_%d", (int)getpid());
+			int file = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+			if(file < 0)
 			{
-				int newCapacity = capacity;
-				if(newCapacity == 0)
-					newCapacity = 2;
-				else
-					newCapacity *= 2;
-				resizeBuffer(newCapacity);
+				std::cout << "[Error]: failed to create the shared memory segment\n";
+				return false;
+			}
+			shm_unlink(name);
+			if(ftruncate(file, segmentSize) != 0)
+			{
+				close(file);
+				std::cout << "[Error]: failed to size the shared memory segment\n";
+				return false;
+			}
+			segment = mmap(NULL, segmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+			close(file);
+			if(segment == MAP_FAILED)
+			{
+				std::cout << "[Error]: failed to map the shared memory segment\n";
+				return false;
 			}
 			
-			// add the rigidbody
-			rigidbodies[rigidbodyCount] = rigidbody;
-			++rigidbodyCount;
+			char* base = (char*)segment;
+			shared = (Shared*)(base + sharedOffset);
+			summaries = (CellMoments*)(base + summaryOffset);
+			histograms = (int*)(base + histogramOffset);
+			inboxes = (Inbox*)(base + inboxOffset);
+			inboxRecords = (BodyRecord*)(base + inboxRecordOffset);
+			results = (BodyRecord*)(base + resultOffset);
 			
-			combinationCount = (int)((rigidbodyCount - 1) * rigidbodyCount * 0.5f + 0.001f);
-			std::cout << "Combination Count: " << combinationCount << "\n";
-		}
-		
-		void removeRigidbody(Rigidbody* rigidbody)
-		{
-			for(int i = 0; i < rigidbodyCount; i++)
+			pthread_barrierattr_t attributes;
+			pthread_barrierattr_init(&attributes);
+			pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+			pthread_barrier_init(&shared->barrier, &attributes, processCount);
+			pthread_barrierattr_destroy(&attributes);
+			new (&shared->overflowBarrier) std::atomic<int>(0);
+			for(int i = 0; i < inboxCount; i++)
+				new (&((Inbox*)((char*)inboxes + i * align(sizeof(Inbox))))->count) std::atomic<uint32_t>(0);
+			
+			// initial bodies and balanced strips
+			for(int i = 0; i < bodyCount; i++)
 			{
-				if(rigidbodies[i] == rigidbody)
+				results[i].id = i;
+				results[i].position = states[i].position;
+				results[i].velocity = states[i].velocity;
+				results[i].mass = states[i].mass;
+			}
+			fillHistogram(histograms, results, bodyCount);
+			computeGrid(histograms, 1);
+			
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			pid_t* workers = new pid_t[processCount];
+			int startedCount = 0;
+			for(; startedCount < processCount; startedCount++)
+			{
+				pid_t pid = fork();
+				if(pid == 0)
 				{
-					// shift the rest of the colliders to the left obscuring the collider to be removed
-					for(int j = min(i + 1, capacity - 1); j < capacity; j++)
-						rigidbodies[i - 1] = rigidbodies[i];
-					rigidbodyCount--;
-					combinationCount = (int)((rigidbodyCount - 1) * rigidbodyCount * 0.5f + 0.001f);
-					return;
+					domain = startedCount;
+					barrierCount = 0;
+					runWorker(stepCount, deltaTime);
+					_exit(0);
 				}
+				if(pid < 0)
+					break;
+				workers[startedCount] = pid;
 			}
-			std::cout << "[Warning]: you're trying to remove a rigidbody which doesn't exist in the Rigidbody Buffer\n";
+			
+			// the workers block on the barrier forever if any of them is missing, so as soon as one fails (or couldn't
+			// be started) the others are killed
+			// only the workers are waited for (polled, whichever ends first), the host's other children are left alone
+			bool succeeded = (startedCount == processCount);
+			if(!succeeded)
+				for(int i = 0; i < startedCount; i++)
+					kill(workers[i], SIGKILL);
+			int runningCount = startedCount;
+			while(runningCount > 0)
+			{
+				for(int worker = 0; worker < startedCount; worker++)
+				{
+					if(workers[worker] == 0) continue;
+					int status;
+					pid_t pid = waitpid(workers[worker], &status, WNOHANG);
+					if(pid == 0) continue;
+					if((pid < 0) && (errno == EINTR)) continue;
+					
+					// an error (the worker was reaped by someone else) counts as a failure
+					workers[worker] = 0;
+					--runningCount;
+					if(succeeded && ((pid < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)))
+					{
+						succeeded = false;
+						for(int i = 0; i < startedCount; i++)
+							if(workers[i] != 0)
+								kill(workers[i], SIGKILL);
+					}
+				}
+				if(runningCount > 0)
+					usleep(1000);
+			}
+			seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			delete[] workers;
+			
+			overflowed = false;
+			if(succeeded)
+				for(int i = 0; i < bodyCount; i++)
+				{
+					states[i].position = results[i].position;
+					states[i].velocity = results[i].velocity;
+				}
+			else if(shared->overflowBarrier.load() != 0)
+				overflowed = true;
+			else
+				std::cout << "[Error]: a worker process of the sharded simulation failed\n";
+			
+			// a killed worker may have been left inside the barrier, which can't be destroyed then (unmapping is enough)
+			if(succeeded)
+				pthread_barrier_destroy(&shared->barrier);
+			munmap(segment, segmentSize);
+			return succeeded;
 		}
 		
-		void calculateDistances()
+		
+	public:
+		ShardedSimulation(Vec2 _worldSize, int _processCount) : worldSize(_worldSize), processCount(_processCount), rebalanceInterval(10), inboxCapacity(0)
 		{
-			/*
-				@ @ @ @ @ @
-				
-			*/
-//			for(int i = 0; i < (rigidbodyCount - 1); i++)
-//				distances[i] = 
+			columnsPerStrip = max(GRID_SIZE / processCount, 1);
+			columnCount = columnsPerStrip * processCount;
+			columnBounds = new float[columnCount];
 		}
+		ShardedSimulation(const ShardedSimulation&) = delete;
+		ShardedSimulation& operator =(const ShardedSimulation&) = delete;
 		
-		void simulate(float deltaTime)
+		~ShardedSimulation()
 		{
-			for(int i = 0; i < rigidbodyCount; i++)
-			{
-				Vec2 force(0, 0);
-				Rigidbody* body1 = rigidbodies[i];
-				for(int j = 0; j < rigidbodyCount; j++)
-				{
-					if(i == j) continue;
-					/*
-					 ForceMagnitude = GRAVITATIONAL_CONSTANT * MASS1 * MASS2 / (DISTANCE * DISTANCE);
-					*/
-					Rigidbody* body2 = rigidbodies[j];
-					Vec2 radiusVector = body1->getTransform()->getPosition() - body2->getTransform()->getPosition();
-					float squaredDistance = radiusVector.sqrMagnitude();
-					float forceMagnitude = GRAVITATIONAL_CONSTANT * body1->getMass() * body2->getMass() / squaredDistance;
-					force += radiusVector.normalized() * forceMagnitude;
-				}
-				body1->applyForce(force);
-				body1->update(deltaTime);
-			}
+			delete[] columnBounds;
 		}
-};
-
-
-struct CirclePhysicalObject
-{
-	private:
-		Rigidbody* rigidbody;
-		CircleCollider* collider;
-		Transform* transform;
-	public:
-		CirclePhysicalObject(const CirclePhysicalObject&) = delete;
-		CirclePhysicalObject& operator =(const CirclePhysicalObject&) = delete;
 		
-		CirclePhysicalObject(float radius)
+		// local launcher: forks processCount workers sharing an anonymous POSIX shared memory segment, runs
+		// stepCount steps and writes the final state back into states
+		// a run which overflows an inbox is restarted with twice its capacity (an inbox of count records can't overflow)
+		// returns the wall clock time of the simulation in seconds (restarts included), or a negative value on failure
+		double run(BodyState* states, int count, int stepCount, float deltaTime)
 		{
-			transform = new Transform();
-			rigidbody = new Rigidbody(transform, 1);
-			collider = new CircleCollider(rigidbody, radius);
+			double totalSeconds = 0;
+			for(recordCapacity = getInboxCapacity(count); ; recordCapacity = min(recordCapacity * 2, count))
+			{
+				double seconds = 0;
+				bool overflowed = false;
+				bool succeeded = launch(states, count, stepCount, deltaTime, seconds, overflowed);
+				totalSeconds += seconds;
+				if(succeeded)
+					return totalSeconds;
+				if(!overflowed || (recordCapacity >= count))
+					return -1;
+				std::cout << "[Warning]: an inbox of the sharded simulation overflowed, restarting with " << min(recordCapacity * 2, count) << " records per inbox\n";
+			}
 		}
-		~CirclePhysicalObject()
+		
+		// same as above with the rigidbodies of a GravitySimulator, whose positions and velocities are written back
+		// (the simulator's own solver settings are not used, and the bodies are not reordered)
+		double run(GravitySimulator& simulator, int stepCount, float deltaTime)
 		{
-			delete rigidbody;
-			delete collider;
-			delete transform;
+			int count = simulator.getRigidbodyCount();
+			Rigidbody* const* rigidbodies = simulator.getRigidbodyBuffer();
+			BodyState* states = new BodyState[count];
+			for(int i = 0; i < count; i++)
+			{
+				states[i].position = rigidbodies[i]->getTransform()->getPosition();
+				states[i].velocity = rigidbodies[i]->getVelocity();
+				states[i].mass = rigidbodies[i]->getMass();
+			}
+			
+			double seconds = run(states, count, stepCount, deltaTime);
+			if(seconds >= 0)
+				for(int i = 0; i < count; i++)
+				{
+					rigidbodies[i]->getTransform()->setPosition(states[i].position);
+					rigidbodies[i]->setVelocity(states[i].velocity);
+				}
+			delete[] states;
+			return seconds;
 		}
 		
+		// setters
+		void setRebalanceInterval(int rebalanceInterval) { this->rebalanceInterval = rebalanceInterval; }
+		// initial records per inbox, 0 = 2 * count / processCount + 1024 (a halo is about 2 * count / columnCount bodies)
+		// the segment holds 2 * processCount inboxes, their capacity is doubled when one overflows (see run)
+		void setInboxCapacity(int inboxCapacity) { this->inboxCapacity = inboxCapacity; }
+		
 		// getters
-		Transform* getTransform() const { return transform; }
-		Rigidbody* getRigidbody() const { return rigidbody; }
-		CircleCollider* getCollider() const { return collider; }
-};
-
-struct Context
-{
-private:
-	Vec2Int screenSize; 		// size of the window in pixel coordinates
-	Vec2 worldSize; 			// size of the world in meters (Rectangular coordinates)
-
-
-public:	
-	Context(Vec2Int _screenSize, float worldWidth) : screenSize(_screenSize)
-	{
-		worldSize.x = worldWidth;
-		worldSize.y = worldWidth * screenSize.y / screenSize.x;
-	}
-	
-	// getters
-	Vec2Int getScreenSize() const { return screenSize; }
-	Vec2 getWorldSize() const { return worldSize; }
-	
-	Vec2 generateRandomPoint() const
-	{
-		int xvalue = rand();
-		int yvalue = rand();
-		static int i = 0; 
-		static Vec2Int dirs[4] = 
-		{
-			{ 1, 1 },
-			{ 1, -1 },
-			{ -1, -1 },
-			{ -1, 1 }
-		};
-		Vec2Int dir = dirs[i % 4]; ++i;	
-		return { dir.x * (xvalue % ((int)(worldSize.x * 0.5f))), dir.y * (yvalue % ((int)(worldSize.y * 0.5f))) };
-	}
-	
-	// converts screen coordinates into world coordinates
-	Vec2 screenToWorldCoordinates(int xScreen, int yScreen) const
-	{
-		yScreen *= -1;
-		xScreen += screenSize.x * 0.5f;
-		yScreen += screenSize.y * 0.5f;
-		float x = worldSize.x * xScreen / screenSize.x;
-		float y = worldSize.y * yScreen / screenSize.y;
-		return { x , y };
-	}
-	
-	Vec2Int worldToScreenCoordinates(const Vec2& world)
-	{
-		return worldToScreenCoordinates(world.x, world.y);
-	}
-	// converts world coordinates into screen coordinates
-	Vec2Int worldToScreenCoordinates(float xWorld, float yWorld) const
-	{
-		int x = screenSize.x * xWorld / worldSize.x;
-		int y = -screenSize.y * yWorld / worldSize.y;
-		return { x + screenSize.x * 0.5f, y + screenSize.y * 0.5f };
-	}
+		int getProcessCount() const { return processCount; }
+		int getRebalanceInterval() const { return rebalanceInterval; }
+		int getInboxCapacity(int count) const
+		{
+			int capacity = (inboxCapacity > 0) ? inboxCapacity : 2 * (count / processCount) + 1024;
+			return min(capacity, count);
+		}
 };
-
-static void drawTrajectory(int count, int* const buffer)
-{
-	setcolor(YELLOW);
-	setlinestyle(DOTTED_LINE, 1, NORM_WIDTH);
-	
-	drawpoly(count, buffer);
-}
-
-
-void renderObjects(Context* context, CircleCollider* const* colliders, int colliderCount)
-{
-	for(int i = 0; i < colliderCount; i++)
-	{
-		// render each object
-		Vec2 position = colliders[i]->getRigidbody()->getTransform()->getPosition();
-   		Vec2Int screenPos = context->worldToScreenCoordinates(position);
-   		arc(screenPos.x, screenPos.y, 0, 360, colliders[i]->getRadius());
-   	}
-}
-
+#endif
 
 #if 1
 int main()
@@ -556,10 +3175,20 @@ int main()
    Context context({ getmaxx(), getmaxy() }, 1000);
    CollisionResolver collisionResolver;
    GravitySimulator gravitySimulator;
+   InitialConditionGenerator generator(SPAWN_SEED);
+   
+   // number of planets spawned so far, also the index of the random stream of the next planet
+   int spawnCount = 0;
 
-   // screen update time (in seconds)
+   // physics update time (in seconds)
    float deltaTime = (float)1 / 30;
    
+   // screen update time (in seconds)
+   float frameInterval = (float)1 / 60;
+   
+   FixedTimestep timestep(deltaTime, frameInterval);
+   TrailHistory trails;
+   
    CirclePhysicalObject* sun = new CirclePhysicalObject(SUN_RADIUS);
    Transform* transform = sun->getCollider()->getRigidbody()->getTransform();
    transform->setPosition({ 0, 0});
@@ -593,31 +3222,47 @@ int main()
    			{
    				CirclePhysicalObject* planet = new CirclePhysicalObject(PLANET_RADIUS_MIN);
    				
+				Vec2 halfWorldSize = context.getWorldSize() * 0.5f;
+   				BodyState state;
+   				generator.generateUniformBox(&state, spawnCount, 1, halfWorldSize * -1, halfWorldSize, PLANET_MASS_MIN);
+   				++spawnCount;
+   				
 				Transform* transform = planet->getTransform();
-   				transform->setPosition(context.generateRandomPoint());
+   				transform->setPosition(state.position);
    				transform->setRotation(0);
    				
 				Rigidbody* rigidbody = planet->getRigidbody();
-   				rigidbody->setMass(PLANET_MASS_MIN);
+   				rigidbody->setMass(state.mass);
+   				rigidbody->setVelocity(state.velocity);
    	
    				gravitySimulator.addRigidbody(rigidbody);
    				collisionResolver.addCollider(planet->getCollider());
    			}
 		}
    		
-   		// simulate gravitational force
-   		gravitySimulator.simulate(deltaTime);
-   		
-   		// resolve collision
-   		collisionResolver.resolve();
-   	
-   		// render the objects
    		CircleCollider* const* colliders = collisionResolver.getColliderBuffer();
    		int colliderCount = collisionResolver.getColliderCount();
-		renderObjects(&context, colliders, colliderCount);
+   		
+   		// run as many fixed physics steps as the real time elapsed since the last frame
+   		int stepCount = timestep.beginFrame();
+   		for(int step = 0; step < stepCount; step++)
+   		{
+   			// simulate gravitational force
+   			gravitySimulator.simulate(deltaTime);
+   			
+   			// resolve collision
+   			collisionResolver.resolve(deltaTime);
+   			
+   			// remember where the bodies went
+   			trails.record(colliders, colliderCount);
+   		}
+   	
+   		// render the objects and their trails
+		renderObjects(&context, colliders, colliderCount, timestep.getAlpha());
+		trails.render(&context, colliders, colliderCount, timestep.getAlpha());
    	
-   		// add a slight delay to be able to see correctly
-   		delay(TO_MILLI_SECONDS(deltaTime));
+   		// sleep until the next frame is due
+   		timestep.waitForNextFrame();
    }
    getch();
    closegraph();
@@ -626,3 +3271,316 @@ int main()
 }
 
 #endif
+
+#if 0
+// headless benchmark of the gravity solvers
+// switch the #if of the game's main() above to 0 and this one to 1
+static void resetBodies(CirclePhysicalObject* const* objects, const BodyState* states, int count)
+{
+	for(int i = 0; i < count; i++)
+	{
+		objects[i]->getTransform()->setPosition(states[i].position);
+		objects[i]->getRigidbody()->setVelocity(states[i].velocity);
+	}
+}
+
+// hardware cache misses (last level) of this process, including the threads it starts while counting
+// stop() returns -1 if the counter is not available (no perf_event_open, or no hardware counters in a VM)
+struct CacheMissCounter
+{
+	private:
+		int file;
+	
+	public:
+		CacheMissCounter() : file(-1)
+		{
+#if defined(__linux__)
+			struct perf_event_attr attributes;
+			memset(&attributes, 0, sizeof(attributes));
+			attributes.type = PERF_TYPE_HARDWARE;
+			attributes.size = sizeof(attributes);
+			attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+			attributes.disabled = 1;
+			attributes.inherit = 1;
+			attributes.exclude_kernel = 1;
+			attributes.exclude_hv = 1;
+			file = (int)syscall(__NR_perf_event_open, &attributes, 0, -1, -1, 0);
+#endif
+		}
+		CacheMissCounter(const CacheMissCounter&) = delete;
+		CacheMissCounter& operator =(const CacheMissCounter&) = delete;
+		
+		~CacheMissCounter()
+		{
+#if defined(__linux__)
+			if(file >= 0)
+				close(file);
+#endif
+		}
+		
+		void start()
+		{
+#if defined(__linux__)
+			if(file < 0) return;
+			ioctl(file, PERF_EVENT_IOC_RESET, 0);
+			ioctl(file, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+		}
+		
+		long long stop()
+		{
+#if defined(__linux__)
+			if(file < 0) return -1;
+			ioctl(file, PERF_EVENT_IOC_DISABLE, 0);
+			long long value;
+			if(read(file, &value, sizeof(value)) == (ssize_t)sizeof(value))
+				return value;
+#endif
+			return -1;
+		}
+};
+
+// average duration (and cache misses) of a simulation step, the bodies move so the mesh is refitted every step
+// the bodies are then put back in their initial state, and its accelerations are written into accelerations
+static double measureSeconds(GravitySimulator& simulator, CirclePhysicalObject* const* objects, const BodyState* states, int count, Vec2* accelerations,
+	int repeatCount, long long* cacheMisses = NULL)
+{
+	CacheMissCounter counter;
+	resetBodies(objects, states, count);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	counter.start();
+	for(int i = 0; i < repeatCount; i++)
+		simulator.simulate((float)1 / 30);
+	long long misses = counter.stop();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / repeatCount;
+	if(cacheMisses != NULL)
+		*cacheMisses = (misses >= 0) ? misses / repeatCount : -1;
+	
+	resetBodies(objects, states, count);
+	simulator.computeAccelerations(accelerations);
+	return seconds;
+}
+
+static void printCacheMisses(long long cacheMisses)
+{
+	if(cacheMisses >= 0)
+		std::cout << ", cache misses: " << cacheMisses;
+	else
+		std::cout << ", cache misses: n/a";
+}
+
+static int compareFloats(const void* a, const void* b)
+{
+	float v1 = *(const float*)a, v2 = *(const float*)b;
+	return (v1 < v2) ? -1 : ((v1 > v2) ? 1 : 0);
+}
+
+// median over the bodies of |a - reference| / |reference|
+// (the mean is dominated by the few unsoftened close pairs of the direct summation)
+static float medianRelativeError(const Vec2* accelerations, const Vec2* reference, int count)
+{
+	float* errors = new float[count];
+	for(int i = 0; i < count; i++)
+	{
+		Vec2 difference(accelerations[i].x - reference[i].x, accelerations[i].y - reference[i].y);
+		errors[i] = difference.magnitude() / reference[i].magnitude();
+	}
+	qsort(errors, count, sizeof(float), compareFloats);
+	float median = errors[count / 2];
+	delete[] errors;
+	return median;
+}
+
+// direct sum with the potential of the mesh, -G * m / sqrt(r * r + h * h)
+static void computeSoftenedAccelerations(const Vec2* positions, const float* masses, int count, float softening, Vec2* accelerations)
+{
+	parallelFor(count, 0, [=](int begin, int end)
+	{
+		for(int i = begin; i < end; i++)
+		{
+			Vec2 acceleration(0, 0);
+			for(int j = 0; j < count; j++)
+			{
+				float dx = positions[j].x - positions[i].x, dy = positions[j].y - positions[i].y;
+				float sqrDistance = dx * dx + dy * dy + softening * softening;
+				float scale = GRAVITATIONAL_CONSTANT * masses[j] / (sqrDistance * sqrt(sqrDistance));
+				acceleration.x += dx * scale;
+				acceleration.y += dy * scale;
+			}
+			accelerations[i] = acceleration;
+		}
+	});
+}
+
+int main()
+{
+	const int bodyCounts[] = { 1024, 4096, 16384 };
+	const int repeatCount = 3;
+	InitialConditionGenerator generator(SPAWN_SEED);
+	
+	for(int n = 0; n < (int)(sizeof(bodyCounts) / sizeof(bodyCounts[0])); n++)
+	{
+		int count = bodyCounts[n];
+		BodyState* states = new BodyState[count];
+		generator.generateUniformBox(states, 0, count, Vec2(-500, -500), Vec2(500, 500), SUN_MASS / count);
+		
+		CirclePhysicalObject** objects = new CirclePhysicalObject*[count];
+		GravitySimulator* simulator = new GravitySimulator(count);
+		for(int i = 0; i < count; i++)
+		{
+			objects[i] = new CirclePhysicalObject(PLANET_RADIUS_MIN);
+			objects[i]->getTransform()->setPosition(states[i].position);
+			objects[i]->getRigidbody()->setMass(states[i].mass);
+			simulator->addRigidbody(objects[i]->getRigidbody());
+		}
+		
+		Vec2* reference = new Vec2[count];
+		Vec2* accelerations = new Vec2[count];
+		
+		simulator->setSolver(GravitySimulator::DIRECT_SUMMATION);
+		double directSeconds = measureSeconds(*simulator, objects, states, count, reference, repeatCount);
+		std::cout << "bodies: " << count << "\n";
+		std::cout << "  direct summation:  " << directSeconds * 1000 << " ms\n";
+		
+		simulator->setSolver(GravitySimulator::PARTICLE_MESH);
+		ParticleMeshSolver* particleMesh = simulator->getParticleMeshSolver();
+		
+		// fixed mesh domain, the few bodies ejected by close encounters would otherwise stretch a fitted mesh
+		particleMesh->setDomainSize(1024);
+		Vec2* softenedReference = new Vec2[count];
+		for(int scheme = 0; scheme < 3; scheme++)
+		{
+			particleMesh->setMassAssignment((scheme == 0) ? ParticleMeshSolver::CLOUD_IN_CELL : ParticleMeshSolver::TRIANGULAR_SHAPED_CLOUD);
+			particleMesh->setShortRangeCorrection(scheme == 2);
+			const char* name = (scheme == 0) ? "PM (CIC):          " : ((scheme == 1) ? "PM (TSC):          " : "P3M (TSC):         ");
+			long long cacheMisses;
+			double seconds = measureSeconds(*simulator, objects, states, count, accelerations, repeatCount, &cacheMisses);
+			
+			// the plain PM force is softened over about a cell, so it is also compared to a sum softened the same way
+			// (the P3M force is exact for the close pairs, its reference is the plain direct sum)
+			if(scheme == 0)
+			{
+				const BodyStorage* storage = simulator->getStorage();
+				computeSoftenedAccelerations(storage->positions, storage->masses, count, particleMesh->getCellSize(), softenedReference);
+			}
+			std::cout << "  " << name << seconds * 1000 << " ms, speedup: " << directSeconds / seconds
+					<< ", median error: " << medianRelativeError(accelerations, reference, count);
+			if(scheme != 2)
+				std::cout << ", vs softened sum: " << medianRelativeError(accelerations, softenedReference, count);
+			printCacheMisses(cacheMisses);
+			std::cout << "\n";
+		}
+		delete[] softenedReference;
+		
+		// same P3M step after sorting the bodies along a space filling curve
+		for(int curve = 0; curve < 2; curve++)
+		{
+			simulator->setSpaceFillingCurve((curve == 0) ? GravitySimulator::MORTON_CURVE : GravitySimulator::HILBERT_CURVE);
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			simulator->reorder();
+			double reorderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			long long cacheMisses;
+			double seconds = measureSeconds(*simulator, objects, states, count, accelerations, repeatCount, &cacheMisses);
+			const char* name = (curve == 0) ? "P3M (TSC, Morton): " : "P3M (TSC, Hilbert):";
+			std::cout << "  " << name << seconds * 1000 << " ms, speedup: " << directSeconds / seconds
+					<< ", reorder: " << reorderSeconds * 1000 << " ms";
+			printCacheMisses(cacheMisses);
+			std::cout << "\n";
+		}
+		
+		// deleting the simulator first spares every body leaving it one by one
+		delete simulator;
+		for(int i = 0; i < count; i++)
+			delete objects[i];
+		delete[] objects;
+		delete[] states;
+		delete[] reference;
+		delete[] accelerations;
+	}
+	
+#if defined(__linux__)
+	// sharded simulation scaling, 1 to 8 worker processes
+	{
+		const int count = 8192;
+		const int stepCount = 10;
+		const float deltaTime = (float)1 / 30;
+		Context context({ 640, 480 }, 1000);
+		Vec2 halfWorldSize = context.getWorldSize() * 0.5f;
+		BodyState* initialStates = new BodyState[count];
+		BodyState* referenceStates = new BodyState[count];
+		BodyState* states = new BodyState[count];
+		
+		// a concentrated distribution, then the uniform box which the GravitySimulator run below uses too
+		for(int distribution = 0; distribution < 2; distribution++)
+		{
+			if(distribution == 0)
+				generator.generatePlummerSphere(initialStates, 0, count, Vec2(0, 0), SUN_MASS, 50);
+			else
+				generator.generateUniformBox(initialStates, 0, count, halfWorldSize * -1, halfWorldSize, SUN_MASS / count);
+			
+			std::cout << "sharded simulation, " << ((distribution == 0) ? "plummer sphere" : "uniform box") << ", bodies: " << count << ", steps: " << stepCount << "\n";
+			double singleSeconds = 0;
+			for(int processCount = 1; processCount <= 8; processCount *= 2)
+			{
+				BodyState* result = (processCount == 1) ? referenceStates : states;
+				for(int i = 0; i < count; i++)
+					result[i] = initialStates[i];
+				ShardedSimulation simulation(context.getWorldSize(), processCount);
+				double seconds = simulation.run(result, count, stepCount, deltaTime);
+				if(processCount == 1)
+					singleSeconds = seconds;
+				
+				// deviation from the single process (exact) run, relative to the distance travelled
+				Vec2* displacements = new Vec2[count];
+				Vec2* deviations = new Vec2[count];
+				for(int i = 0; i < count; i++)
+				{
+					displacements[i] = Vec2(referenceStates[i].position.x - initialStates[i].position.x, referenceStates[i].position.y - initialStates[i].position.y);
+					deviations[i] = Vec2(result[i].position.x - initialStates[i].position.x, result[i].position.y - initialStates[i].position.y);
+				}
+				std::cout << "  processes: " << processCount << ", " << seconds * 1000 / stepCount << " ms per step, speedup: " << singleSeconds / seconds
+						<< ", median error: " << medianRelativeError(deviations, displacements, count) << "\n";
+				delete[] displacements;
+				delete[] deviations;
+			}
+		}
+		
+		// same bodies driven through a GravitySimulator, must match the 4 process run above
+		{
+			CirclePhysicalObject** objects = new CirclePhysicalObject*[count];
+			GravitySimulator* simulator = new GravitySimulator(count);
+			for(int i = 0; i < count; i++)
+			{
+				objects[i] = new CirclePhysicalObject(PLANET_RADIUS_MIN);
+				objects[i]->getTransform()->setPosition(initialStates[i].position);
+				objects[i]->getRigidbody()->setVelocity(initialStates[i].velocity);
+				objects[i]->getRigidbody()->setMass(initialStates[i].mass);
+				simulator->addRigidbody(objects[i]->getRigidbody());
+			}
+			for(int i = 0; i < count; i++)
+				states[i] = initialStates[i];
+			ShardedSimulation simulation(context.getWorldSize(), 4);
+			double seconds = simulation.run(*simulator, stepCount, deltaTime);
+			simulation.run(states, count, stepCount, deltaTime);
+			int mismatchCount = 0;
+			for(int i = 0; i < count; i++)
+			{
+				Vec2 position = objects[i]->getTransform()->getPosition();
+				if((position.x != states[i].position.x) || (position.y != states[i].position.y))
+					++mismatchCount;
+			}
+			std::cout << "  processes: 4 (GravitySimulator), " << seconds * 1000 / stepCount << " ms per step, mismatches: " << mismatchCount << "\n";
+			
+			delete simulator;
+			for(int i = 0; i < count; i++)
+				delete objects[i];
+			delete[] objects;
+		}
+		delete[] initialStates;
+		delete[] referenceStates;
+		delete[] states;
+	}
+#endif
+	return 0;
+}
+#endif